@@ -67,7 +67,7 @@ int* sort(int* array, int len)
     
     while (swap) {
         swap = FALSE;
-        for (i=0; i<len; i++) {
+        for (i=0; i<len-1; i++) {
             if (array[i] > array[i+1]) {
                 temp = array[i];
                 array[i] = array[i+1];
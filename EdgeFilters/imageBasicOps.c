@@ -7,6 +7,7 @@
  */
 
 #include "imageBasicOps.h"
+#include "imageFFT.h"
 
 /*! \fn int absolutePGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Convert each pixel of the image \a pgmIn to its absolute value. The final result is stored in \a pgmOut.
@@ -17,7 +18,7 @@
  */
 int absolutePGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    int i;
+    int i, j;
     int pixel;
     int max_val = 0;
     
@@ -36,16 +37,29 @@ int absolutePGM(Pgm* pgmIn, Pgm* pgmOut)
         return -1;
     }
     
+    // The absolute values fit in the magnitude of the input range
+    double lo, hi;
+    rangeFormatPGM(pgmIn->format, &lo, &hi);
+    Pgm* out = targetPGM(pgmOut, fitFormatPGM(0, fmax(-lo, hi)), pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        pixel = abs(pgmIn->pixels[i]);
-        pgmOut->pixels[i] = pixel;
-        if ( pixel > max_val)
-            max_val = pixel;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for (j = 0; j < width; j++) {
+            pixel = abs(pixels[j]);
+            pixels[j] = pixel;
+            if ( pixel > max_val)
+                max_val = pixel;
+        }
+        setRowPGM(out, i, 0, width, pixels);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = max_val;
     
+    free(pixels);
+    
     return 0;
 }
 
@@ -53,7 +67,7 @@ int absolutePGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Binarize an image \a pgmIn based on the \a threshold value. The result is stored in \a pgmOut.
  *
  * Each pixel's value greater or equal than the \a threshold is converted to the value 255. All other pixels
- * are set to 0.
+ * are set to 0. Negative thresholds are treated as 0.
  * \param pgmIn Pointer to the input Pgm image structure.
  * \param pgmOut Pointer to the output Pgm image structure.
  * \param threshold The threshold value.
@@ -61,7 +75,7 @@ int absolutePGM(Pgm* pgmIn, Pgm* pgmOut)
  */
 int thresholdPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold)
 {
-    int i;
+    int i, j;
 
     if(!pgmIn)
     {
@@ -78,25 +92,33 @@ int thresholdPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold)
         return -1;
     }
     
-    // Limit the threshold value between 0 and 255
-    if (threshold > 255) {
-        threshold = 255;
-    }
-    
+    // Negative thresholds are equivalent to 0. There is no upper limit
+    // since the input can have more than 8 bits per pixel
     if (threshold < 0) {
         threshold = 0;
     }
 
+    // A binary image needs a single byte per pixel
+    Pgm* out = targetPGM(pgmOut, PGM_U8, pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++)
-        // Set the output value to black or white if it is
-        // below or above the threshold
-        if (pgmIn->pixels[i]>=threshold)
-            pgmOut->pixels[i] = 255;
-        else
-            pgmOut->pixels[i] =0;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for (j = 0; j < width; j++)
+            // Set the output value to black or white if it is
+            // below or above the threshold
+            if (pixels[j]>=threshold)
+                pixels[j] = 255;
+            else
+                pixels[j] = 0;
+        setRowPGM(out, i, 0, width, pixels);
+    }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = 255;
+    
+    free(pixels);
 
     return 0;
 }
@@ -115,7 +137,7 @@ int thresholdPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold)
  */
 int linearAddPGM(Pgm* pgmOp1, Pgm* pgmOp2, double w1, double w2, Pgm* pgmOut)
 {
-    int i;
+    int i, j;
     int pixel;
     int max_val = 0;
 
@@ -134,16 +156,35 @@ int linearAddPGM(Pgm* pgmOp1, Pgm* pgmOp2, double w1, double w2, Pgm* pgmOut)
         return -1;
     }
     
+    // Bound the weighted sum with the ranges of the two operands
+    double lo1, hi1, lo2, hi2;
+    rangeFormatPGM(pgmOp1->format, &lo1, &hi1);
+    rangeFormatPGM(pgmOp2->format, &lo2, &hi2);
+    PgmFormat format = fitFormatPGM(floor(fmin(w1*lo1, w1*hi1) + fmin(w2*lo2, w2*hi2)),
+                                    ceil(fmax(w1*lo1, w1*hi1) + fmax(w2*lo2, w2*hi2)));
+    Pgm* out = targetPGM(pgmOut, format, pgmOut == pgmOp1 || pgmOut == pgmOp2);
+    int* pixels1 = (int*)malloc(width*sizeof(int));
+    int* pixels2 = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        pixel = (int)(w1*pgmOp1->pixels[i] + w2*pgmOp2->pixels[i]);
-        pgmOut->pixels[i] = pixel;
-        if ( pixel > max_val)
-            max_val = pixel;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmOp1, i, 0, width, pixels1);
+        getRowPGM(pgmOp2, i, 0, width, pixels2);
+        for (j = 0; j < width; j++) {
+            pixel = (int)(w1*pixels1[j] + w2*pixels2[j]);
+            pixels1[j] = pixel;
+            if ( pixel > max_val)
+                max_val = pixel;
+        }
+        setRowPGM(out, i, 0, width, pixels1);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = max_val;
     
+    free(pixels1);
+    free(pixels2);
+    
     return 0;
 }
 
@@ -155,7 +196,8 @@ int linearAddPGM(Pgm* pgmOp1, Pgm* pgmOp2, double w1, double w2, Pgm* pgmOut)
  */
 int comparePGM(Pgm* pgmOp1, Pgm* pgmOp2)
 {
-    int i;
+    int i, j;
+    int ret = 0;
     
     if(!pgmOp1 | !pgmOp2)
     {
@@ -166,12 +208,35 @@ int comparePGM(Pgm* pgmOp1, Pgm* pgmOp2)
     int width = pgmOp1->width;
     int height = pgmOp1->height;
     
+    // Rows of images with the same storage format can be compared byte by byte.
+    // The padding at the end of the rows is skipped.
+    if (pgmOp1->format == pgmOp2->format) {
+        size_t strideBytes = bytesPGM(pgmOp1)/height;
+        size_t rowBytes = strideBytes/pgmOp1->stride*width;
+        for (i = 0; i < height; i++)
+            if (memcmp((char*)pgmOp1->pixels + i*strideBytes, (char*)pgmOp2->pixels + i*strideBytes, rowBytes) != 0)
+                return 1;
+        return 0;
+    }
+    
+    int* pixels1 = (int*)malloc(width*sizeof(int));
+    int* pixels2 = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++)
-        if (pgmOp1->pixels[i] != pgmOp2->pixels[i])
-            return 1;
+    for (i = 0; (i < height) && !ret; i++) {
+        getRowPGM(pgmOp1, i, 0, width, pixels1);
+        getRowPGM(pgmOp2, i, 0, width, pixels2);
+        for (j = 0; j < width; j++)
+            if (pixels1[j] != pixels2[j]) {
+                ret = 1;
+                break;
+            }
+    }
     
-    return 0;
+    free(pixels1);
+    free(pixels2);
+    
+    return ret;
 }
 
 /*! \fn int modulePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
@@ -185,7 +250,7 @@ int comparePGM(Pgm* pgmOp1, Pgm* pgmOp2)
  */
 int modulePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
 {
-    int i;
+    int i, j;
     int pixel;
     int max_val = 0;
 
@@ -204,17 +269,37 @@ int modulePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
         return -1;
     }
     
+    // The module is bounded by the module of the largest components
+    double loX, hiX, loY, hiY;
+    rangeFormatPGM(pgmOpX->format, &loX, &hiX);
+    rangeFormatPGM(pgmOpY->format, &loY, &hiY);
+    PgmFormat format = fitFormatPGM(0, hypot(fmax(-loX, hiX), fmax(-loY, hiY)));
+    Pgm* out = targetPGM(pgmOut, format, pgmOut == pgmOpX || pgmOut == pgmOpY);
+    int* pixelsX = (int*)malloc(width*sizeof(int));
+    int* pixelsY = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        pixel = (int)sqrt(pgmOpX->pixels[i]*pgmOpX->pixels[i] +
-                             pgmOpY->pixels[i]*pgmOpY->pixels[i]);
-        pgmOut->pixels[i] = pixel;
-        if (pixel > max_val)
-            max_val = pixel;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmOpX, i, 0, width, pixelsX);
+        getRowPGM(pgmOpY, i, 0, width, pixelsY);
+        for (j = 0; j < width; j++) {
+            // squares are summed in double precision since they overflow
+            // an integer for images with more than 8 bits per pixel
+            pixel = (int)sqrt((double)pixelsX[j]*pixelsX[j] +
+                              (double)pixelsY[j]*pixelsY[j]);
+            pixelsX[j] = pixel;
+            if (pixel > max_val)
+                max_val = pixel;
+        }
+        setRowPGM(out, i, 0, width, pixelsX);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = max_val;
     
+    free(pixelsX);
+    free(pixelsY);
+    
     return 0;
 }
 
@@ -229,7 +314,7 @@ int modulePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
  */
 int phasePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
 {
-    int i;
+    int i, j;
     int pixel;
     int max_val = 0;
     double phi;
@@ -249,33 +334,192 @@ int phasePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
         return -1;
     }
 
+    // The phase is in the interval [-127, 127]
+    Pgm* out = targetPGM(pgmOut, fitFormatPGM(-127, 127), pgmOut == pgmOpX || pgmOut == pgmOpY);
+    int* pixelsX = (int*)malloc(width*sizeof(int));
+    int* pixelsY = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        phi = atan2(pgmOpY->pixels[i], pgmOpX->pixels[i])*M_1_PI*127;
-        pixel = (int)phi;
-        pgmOut->pixels[i] = pixel;
-        if (pixel > max_val)
-            max_val = pixel;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmOpX, i, 0, width, pixelsX);
+        getRowPGM(pgmOpY, i, 0, width, pixelsY);
+        for (j = 0; j < width; j++) {
+            phi = atan2(pixelsY[j], pixelsX[j])*M_1_PI*127;
+            pixel = (int)phi;
+            pixelsX[j] = pixel;
+            if (pixel > max_val)
+                max_val = pixel;
+        }
+        setRowPGM(out, i, 0, width, pixelsX);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = max_val;
+    
+    free(pixelsX);
+    free(pixelsY);
 
     return 0;
 }
 
-/*! \fn int int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
- int (*func)(Pgm*, Pgm*, double*, int, int, int))
- * \brief SScan an image and apply a function \a func to each pixel.
+// The border policy used by fapplyPGM and the value of the pixels outside
+// the image for the BORDER_CONSTANT policy
+BorderPolicy borderPolicy = BORDER_REPLICATE;
+int borderValue = 0;
+
+/*! \fn void borderPGM(BorderPolicy policy, int value)
+ * \brief Select how fapplyPGM computes the pixels outside the image borders.
+ * \param policy The border policy.
+ * \param value The value of the pixels outside the image for the BORDER_CONSTANT policy.
+ */
+void borderPGM(BorderPolicy policy, int value)
+{
+    borderPolicy = policy;
+    borderValue = value;
+}
+
+/*! \fn void haloRangePGM(Pgm* pgm, int halo, int* min, int* max)
+ * \brief Return in \a min and \a max the range of the values of \a pgm and, if \a halo is not 0,
+ *        of the pixels outside the image computed according to the border policy.
+ * \param pgm Pointer to the Pgm image structure.
+ * \param halo 0 if no pixel outside the image is used.
+ * \param min Pointer to the integer receiving the minimum value.
+ * \param max Pointer to the integer receiving the maximum value.
+ */
+void haloRangePGM(Pgm* pgm, int halo, int* min, int* max)
+{
+    rangePGM(pgm, min, max);
+    // the pixels outside the image may have the constant border value
+    if (halo && borderPolicy == BORDER_CONSTANT) {
+        *min = borderValue < *min ? borderValue : *min;
+        *max = borderValue > *max ? borderValue : *max;
+    }
+}
+
+/*! \fn int borderIndex(int i, int n)
+ * \brief Map the index \a i of a row or column outside [0, \a n) to the index of the pixel that replaces it.
+ * \param i The index of the row or column.
+ * \param n The number of rows or columns in the image.
+ * \return The index in [0, \a n) or -1 if the pixel has the constant border value.
+ */
+int borderIndex(int i, int n)
+{
+    if (i >= 0 && i < n)
+        return i;
+    
+    switch (borderPolicy) {
+        case BORDER_CONSTANT:
+            return -1;
+        case BORDER_REFLECT:
+            if (n == 1)
+                return 0;
+            // reflect as many times as needed for spans larger than the image
+            while (i < 0 || i >= n)
+                i = i < 0 ? -i : 2*(n-1)-i;
+            return i;
+        default:
+            return i < 0 ? 0 : n-1;
+    }
+}
+
+/*! \fn void haloRow(int* dst, int width, int spanX, int outside)
+ * \brief Fill the \a spanX halo pixels at each side of the row \a dst of \a width pixels.
  *
- * It scans the image \a pgmIn1 and to each pixel in the image applies the function \a func.
- * The function \a func receives 6 parameters:
- *  - \a pgmIn1
- *  - \a pgmIn2
- *  - \a filter->kernel (if != NULL)
- *  - dimX/2
- *  - dimY/2
- *  - a linear index in the \a pgmIn1->pixels array
- * Each pixel in \a pgmOut is replaced with the return value of \a func for the corresponding pixel in \a pgmIn1.
+ * The halo pixels are computed according to the border policy.
+ * \param dst Pointer to the first pixel of the row.
+ * \param width The number of pixels in the row.
+ * \param spanX The number of halo pixels on the left and on the right of the row.
+ * \param outside If set to 1 the row is a row outside the image that borderIndex() does not replace,
+ *        and all its pixels are filled.
+ */
+void haloRow(int* dst, int width, int spanX, int outside)
+{
+    int k, l, r;
+    
+    if (outside) {
+        for (k = -spanX; k < width+spanX; k++)
+            dst[k] = borderValue;
+        return;
+    }
+    
+    for (k = 1; k <= spanX; k++) {
+        l = borderIndex(-k, width);
+        r = borderIndex(width-1+k, width);
+        dst[-k] = l < 0 ? borderValue : dst[l];
+        dst[width-1+k] = r < 0 ? borderValue : dst[r];
+    }
+}
+
+/*! \fn void loadStripRow(Pgm* pgm, int row, int spanX, int* dst)
+ * \brief Copy the row \a row of \a pgm in \a dst and fill \a spanX halo pixels at each side.
+ *
+ * Rows and columns outside the image are computed according to the border policy.
+ * \param pgm Pointer to the Pgm image structure.
+ * \param row The index of the row, possibly outside the image.
+ * \param spanX The number of halo pixels on the left and on the right of the row.
+ * \param dst Pointer to the position of the first image pixel in the strip row.
+ */
+void loadStripRow(Pgm* pgm, int row, int spanX, int* dst)
+{
+    int width = pgm->width;
+    
+    row = borderIndex(row, pgm->height);
+    if (row >= 0)
+        getRowPGM(pgm, row, 0, width, dst);
+    haloRow(dst, width, spanX, row < 0);
+}
+
+/*! \fn void loadSpanRow(Pgm* pgm, int row, int col, int len, int* dst)
+ * \brief Copy \a len pixels of the row \a row of \a pgm from the column \a col in \a dst.
+ *
+ * Rows outside the image are computed according to the border policy, the columns must be inside.
+ * \param pgm Pointer to the Pgm image structure.
+ * \param row The index of the row, possibly outside the image.
+ * \param col The index of the first column.
+ * \param len The number of pixels to copy.
+ * \param dst Pointer to the destination buffer.
+ */
+void loadSpanRow(Pgm* pgm, int row, int col, int len, int* dst)
+{
+    int k;
+    
+    row = borderIndex(row, pgm->height);
+    if (row < 0) {
+        for (k = 0; k < len; k++)
+            dst[k] = borderValue;
+        return;
+    }
+    
+    getRowPGM(pgm, row, col, len, dst);
+}
+
+/*! \fn PgmFormat kernelFormatPGM(Pgm* pgm, double* kernel, int dimX, int dimY)
+ * \brief Return the format of the convolution of \a pgm with the \a dimX x \a dimY matrix \a kernel.
+ *
+ * The output range is bounded by the sums of the weights times the input range.
+ */
+PgmFormat kernelFormatPGM(Pgm* pgm, double* kernel, int dimX, int dimY)
+{
+    int k, lo, hi;
+    double outMin = 0, outMax = 0;
+    
+    haloRangePGM(pgm, dimX > 1 || dimY > 1, &lo, &hi);
+    for (k = 0; k < dimX*dimY; k++) {
+        outMin += fmin(kernel[k]*lo, kernel[k]*hi);
+        outMax += fmax(kernel[k]*lo, kernel[k]*hi);
+    }
+    
+    // allow for the rounding errors of the sums in convolution2DKernel
+    return fitFormatPGM(floor(outMin - 1e-6), floor(outMax + 1e-6));
+}
+
+/*! \fn int stripApplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
+ int (*func)(Pgm*, Pgm*, double*, int, int, int), void (*rowFunc)(Pgm*, double*, int, int, int, int*))
+ * \brief Scan an image strip by strip as fapplyPGM() and compute the output pixels either one at a time
+ *        with \a func or a row at a time with \a rowFunc.
+ *
+ * When \a rowFunc is not NULL it receives the strip of \a pgmIn1, \a filter->kernel, dimX/2, dimY/2,
+ * the linear index in the strip of the first pixel of the row and the buffer where it stores the row.
  * \param pgmIn1 Pointer to the first Pgm image structure.
  * \param pgmIn2 Pointer to a second Pgm image structure that can optionally be accessed by \a func.
  * \param pgmOut Pointer to the output Pgm image structure.
@@ -283,16 +527,18 @@ int phasePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut)
  * \param dimX The dimension along X of the subarray of \a pgmIn1 checked by \a func.
  * \param dimY The dimension along Y of the subarray of \a pgmIn1 checked by \a func.
  * \param func The function used to compute the value of the output pixel.
+ * \param rowFunc The function used to compute a row of output pixels. If not NULL \a func is not used.
  * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
  */
-int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
-              int (*func)(Pgm*, Pgm*, double*, int, int, int))
+int stripApplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
+                  int (*func)(Pgm*, Pgm*, double*, int, int, int), void (*rowFunc)(Pgm*, double*, int, int, int, int*))
 {
-    int row, col;
+    int row, col, k;
     int pixel;
     int max_val = 0;
+    int min_val = 0; // only max_val is used
     double *kernel = NULL; // a local pointer to the filter matrix if defined
-    int ic; // the index of the central pixel in the source image
+    int ic; // the index of the central pixel in the strip
 
     
     if(!pgmIn1)
@@ -322,31 +568,82 @@ int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, i
     // Start Timestamp
     struct timeval tvStart;
     gettimeofday(&tvStart, NULL);
-
-    // Move to the first useful interior pixel
-    ic = spanY*width+spanX;
+    
+    // The strips of the source images, with spanY extra rows at the top and at the bottom
+    // and spanX extra columns on the left and on the right. The left halo is padded so
+    // that the first pixel of each image row is aligned.
+    const int align = ROW_ALIGN/sizeof(int);
+    int stripHeight = STRIP_ROWS + 2*spanY;
+    int left = (spanX + align-1)/align*align;
+    int stride = left + (width + spanX + align-1)/align*align;
+    size_t stripBytes = (size_t)stride*stripHeight*sizeof(int);
+    
+    int *base1 = NULL, *base2 = NULL;
+    Pgm strip1 = {width, stripHeight, pgmIn1->max_val, PGM_S32, stride, NULL};
+    Pgm strip2 = {width, stripHeight, 0, PGM_S32, stride, NULL};
+    base1 = getBufferPGM(stripBytes);
+    strip1.pixels = base1 + left;
+    if (pgmIn2) {
+        base2 = getBufferPGM(stripBytes);
+        strip2.max_val = pgmIn2->max_val;
+        strip2.pixels = base2 + left;
+    }
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    
+    // Without a filter func returns values in the range of pgmIn1
+    PgmFormat format = kernel ? kernelFormatPGM(pgmIn1, kernel, dimX, dimY) : pgmIn1->format;
+    reformatPGM(pgmOut, format);
+    
     D(fprintf(stderr,"w=%d,h=%d\n",width,height));
     D(fprintf(stderr,"bw=%d,bh=%d\n",spanX,spanY));
     
-    // Loop over all internal source image pixels
-    for (row = spanY; row < height-spanY; row++, ic += spanX*2) {
-        D(fprintf(stderr,"start:row=%d,ic=%d\n",row,ic));
-        for (col = spanX; col < width-spanX; col++, ic++) {
-            D(fprintf(stderr,"(%d,%d),ic=%d\n", row, col, ic));
-            
-            // Apply the function to each pixel neighborhood
-            pixel = func(pgmIn1, pgmIn2, kernel, spanX, spanY, ic);
-
-            pgmOut->pixels[ic] = pixel;
-            if (pixel > max_val)
-                max_val = pixel;
+    // Loop over all strips of source image rows
+    int first, rows;
+    int loaded = 0; // rows of the previous strip still valid at the top of the buffers
+    for (first = 0; first < height; first += rows) {
+        rows = height-first < STRIP_ROWS ? height-first : STRIP_ROWS;
+        
+        // load the source rows from first-spanY to first+rows+spanY
+        for (k = loaded; k < rows+2*spanY; k++) {
+            loadStripRow(pgmIn1, first-spanY+k, spanX, (int*)strip1.pixels + k*stride);
+            if (pgmIn2)
+                loadStripRow(pgmIn2, first-spanY+k, spanX, (int*)strip2.pixels + k*stride);
+        }
+        
+        for (row = 0; row < rows; row++) {
+            D(fprintf(stderr,"start:row=%d\n",first+row));
+            ic = (row+spanY)*stride;
+            if (rowFunc) {
+                // Apply the function to the whole row
+                rowFunc(&strip1, kernel, spanX, spanY, ic, outPixels);
+                kernelsPGM()->rangeRow(outPixels, width, &min_val, &max_val);
+            } else
+                for (col = 0; col < width; col++, ic++) {
+                    D(fprintf(stderr,"(%d,%d),ic=%d\n", first+row, col, ic));
+                    
+                    // Apply the function to each pixel neighborhood
+                    pixel = func(&strip1, pgmIn2 ? &strip2 : NULL, kernel, spanX, spanY, ic);
+                    
+                    outPixels[col] = pixel;
+                    if (pixel > max_val)
+                        max_val = pixel;
+                }
+            setRowPGM(pgmOut, first+row, 0, width, outPixels);
         }
-        D(fprintf(stderr,"end:row=%d,ic=%d\n",row,ic));
-        // move the index of the central pixel to the next row
+        
+        // keep the last 2*spanY rows, they are the top rows of the next strip
+        loaded = 2*spanY;
+        memmove(base1, base1 + rows*stride, (size_t)loaded*stride*sizeof(int));
+        if (pgmIn2)
+            memmove(base2, base2 + rows*stride, (size_t)loaded*stride*sizeof(int));
     }
     
     pgmOut->max_val = max_val;
     
+    putBufferPGM(base1, stripBytes);
+    putBufferPGM(base2, stripBytes);
+    free(outPixels);
+    
     // Stop Timestamp
     struct timeval tvStop;
     gettimeofday(&tvStop, NULL);
@@ -357,6 +654,42 @@ int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, i
     return 0;
 }
 
+/*! \fn int int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
+ int (*func)(Pgm*, Pgm*, double*, int, int, int))
+ * \brief SScan an image and apply a function \a func to each pixel.
+ *
+ * It scans the image \a pgmIn1 and to each pixel in the image applies the function \a func.
+ * The image is processed in strips of STRIP_ROWS rows. The rows of each strip, together with
+ * the dimY/2 rows above and below it, are converted to integers in a buffer that \a func
+ * accesses as a Pgm image of format PGM_S32 with the same width of \a pgmIn1. Each row of the
+ * buffer has dimX/2 halo pixels on both sides and starts at a ROW_ALIGN boundary. The rows and
+ * the halo pixels outside the image are filled according to the border policy set by borderPGM(),
+ * so \a func computes every pixel of the image, borders included, without bound checks.
+ * \a pgmOut is stored with the format of \a pgmIn1 or, when a \a filter is given, with the narrowest
+ * format that can hold any convolution of the values of \a pgmIn1 with \a filter->kernel.
+ * The function \a func receives 6 parameters:
+ *  - the strip of \a pgmIn1
+ *  - the strip of \a pgmIn2 (if != NULL)
+ *  - \a filter->kernel (if != NULL)
+ *  - dimX/2
+ *  - dimY/2
+ *  - a linear index in the strip of the pixel to compute (row * stride + column)
+ * Each pixel in \a pgmOut is replaced with the return value of \a func for the corresponding pixel in \a pgmIn1.
+ * \param pgmIn1 Pointer to the first Pgm image structure.
+ * \param pgmIn2 Pointer to a second Pgm image structure that can optionally be accessed by \a func.
+ * \param pgmOut Pointer to the output Pgm image structure.
+ * \param filter Pointer to an optional Filter structure.
+ * \param dimX The dimension along X of the subarray of \a pgmIn1 checked by \a func.
+ * \param dimY The dimension along Y of the subarray of \a pgmIn1 checked by \a func.
+ * \param func The function used to compute the value of the output pixel.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
+              int (*func)(Pgm*, Pgm*, double*, int, int, int))
+{
+    return stripApplyPGM(pgmIn1, pgmIn2, pgmOut, filter, dimX, dimY, func, NULL);
+}
+
 /*! \fn int convolution2DKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
  * \brief Convolve an image \a pgmIn with a matrix stored in \a kernel. The result is stored in \a pgmOut.
  *
@@ -375,13 +708,14 @@ int convolution2DKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int
     int k,l, il;
     double sum = 0;
     
-    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
+    int* pixels = pgmIn1->pixels;
     
     int ix = 0;
     // Iterate over all filter pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
+    for (k=-spanY, il = ic-stride*spanY; k <= spanY; k++, il += stride)
         for (l=-spanX; l <= spanX; l++)
-            sum += pgmIn1->pixels[il+l]*kernel[ix++];
+            sum += pixels[il+l]*kernel[ix++];
     
     return (int)floor(sum);
 }
@@ -389,6 +723,8 @@ int convolution2DKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int
 /*! \fn int convolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
  * \brief Apply to the image \a pgmIn a 2D convolution with the Filter \a filter.
  * Store in \a pgmOut the result
+ * Kernels that are sums of few separable terms are applied with separableConvolutionPGM(), other
+ * large kernels, from the size returned by fftCrossoverPGM(), with fftConvolution2DPGM().
  * \param pgmIn Pointer to the input Pgm image structure.
  * \param pgmOut Pointer to the output Pgm image structure.
  * \param filter Pointer to the Filter structure.
@@ -396,7 +732,13 @@ int convolution2DKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int
  */
 int convolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
 {
-    return fapplyPGM(pgmIn, NULL, pgmOut, filter, 0, 0, convolution2DKernel);
+    if (pgmIn && pgmOut && filter && separableConvolutionPays(filter))
+        return separableConvolutionPGM(pgmIn, pgmOut, filter);
+    
+    if (pgmIn && pgmOut && filter && fftConvolutionPays(filter))
+        return fftConvolution2DPGM(pgmIn, pgmOut, filter);
+    
+    return stripApplyPGM(pgmIn, NULL, pgmOut, filter, 0, 0, NULL, kernelsPGM()->convolutionRow);
 }
 
 /*! \fn int convolution1DXPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
@@ -409,14 +751,72 @@ int convolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
  */
 int convolution1DXPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
 {
-    int row, col, l;
-    double sum;
-    int pixelVal;
-    int topVal = 0;
+    if(!filter) {
+        fprintf(stderr, "Error! No filter defined. Please Check.\n");
+        return -1;
+    }
     
-    int ix; // the index in the filter
-    int ic; // the index of the central pixel in the source image
-    int il; // the index of the pixel used in the integration
+    // A filter with a single row is applied to all the image rows
+    return stripApplyPGM(pgmIn, NULL, pgmOut, filter, 0, 0, NULL, kernelsPGM()->convolutionRow);
+}
+
+/*! \fn int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+ * \brief Apply to the image \a pgmIn  a one-dimensional convolution
+ * with the Filter \a filter along the image rows.
+ * \param pgmIn Pointer to the input Pgm image structure.
+ * \param pgmOut Pointer to the output Pgm image structure.
+ * \param filter Pointer to the Filter structure.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+{
+    if(!filter) {
+        fprintf(stderr, "Error! No filter defined. Please Check.\n");
+        return -1;
+    }
+    
+    // A filter with a single column is applied to all the image columns
+    return stripApplyPGM(pgmIn, NULL, pgmOut, filter, 0, 0, NULL, kernelsPGM()->convolutionRow);
+}
+
+/*! \fn int separableConvolutionPays(Filter* filter)
+ * \brief Return 1 if the convolution with \a filter is faster as a sum of separable terms.
+ *
+ * The kernel must have odd dimensions larger than 1, and its terms, with the extra cost of the two passes
+ * (see SEPARABLE_TAP_COST and SEPARABLE_ROW_COST), must cost less than the direct convolution.
+ */
+int separableConvolutionPays(Filter* filter)
+{
+    int width = filter->width;
+    int height = filter->height;
+    
+    if (width < 2 || height < 2 || width%2 == 0 || height%2 == 0)
+        return 0;
+    
+    double* cols = (double*)malloc(SEPARABLE_MAX_RANK*height*sizeof(double));
+    double* rows = (double*)malloc(SEPARABLE_MAX_RANK*width*sizeof(double));
+    int rank = separateFilter(filter, cols, rows, SEPARABLE_MAX_RANK);
+    free(cols);
+    free(rows);
+    
+    return rank > 0 && rank*(width+height)*SEPARABLE_TAP_COST+SEPARABLE_ROW_COST < width*height;
+}
+
+/*! \fn int separableConvolutionPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+ * \brief Apply to the image \a pgmIn a 2D convolution with the Filter \a filter decomposed by separateFilter().
+ *
+ * Each source row is filtered along x by the rows of the terms, and each output row is the sum of the
+ * columns of the terms applied along y to the last filtered rows. The intermediate results are kept in
+ * double precision and rounded down once, after adding 1e-6 to absorb the rounding errors on the exact
+ * integer results of integer kernels, so they are the same of convolution2DPGM() up to that rounding.
+ * \param pgmIn Pointer to the input Pgm image structure.
+ * \param pgmOut Pointer to the output Pgm image structure.
+ * \param filter Pointer to the Filter structure, with odd dimensions.
+ * \return 0 on success, -1 if either pgmIn, pgmOut or filter are NULL or the kernel has too many terms.
+ */
+int separableConvolutionPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+{
+    int i, j, k, l, t;
     
     if(!pgmIn)
     {
@@ -430,69 +830,118 @@ int convolution1DXPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
         return -1;
     }
     
-    if(!filter) {
+    if(!filter)
+    {
         fprintf(stderr, "Error! No filter defined. Please Check.\n");
         return -1;
     }
     
+    int dimX = filter->width;
+    int dimY = filter->height;
+    double* cols = (double*)malloc(SEPARABLE_MAX_RANK*dimY*sizeof(double));
+    double* rows = (double*)malloc(SEPARABLE_MAX_RANK*dimX*sizeof(double));
+    int rank = separateFilter(filter, cols, rows, SEPARABLE_MAX_RANK);
+    if (rank == 0)
+    {
+        fprintf(stderr, "Error! The kernel is not separable. Please Check.\n");
+        free(cols);
+        free(rows);
+        return -1;
+    }
+    
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    int spanX = dimX/2;
+    int spanY = dimY/2;
     int width = pgmIn->width;
     int height = pgmIn->height;
     
-    int filterWidth = filter->width;
-    int halfFilterWidth = filterWidth/2;
-    
-    // Move to the first useful interior pixel
-    ic = halfFilterWidth;
-    D(fprintf(stderr,"w=%d,h=%d\n",width,height));
+    PgmFormat format = kernelFormatPGM(pgmIn, filter->kernel, dimX, dimY);
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    // the last dimY source rows filtered along x by each term, source row r in slot (r+spanY)%dimY
+    const KernelSet* kernels = kernelsPGM();
+    int* line = (int*)malloc((width+2*spanX)*sizeof(int));
+    double* lineD = (double*)malloc((width+2*spanX)*sizeof(double));
+    double* filtered = (double*)malloc((size_t)rank*dimY*width*sizeof(double));
+    double* sums = (double*)malloc(width*sizeof(double));
+    double* total = (double*)malloc(width*sizeof(double));
+    double** taps = (double**)malloc((dimX > dimY ? dimX : dimY)*sizeof(double*)); // the rows of the weighted sums
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    int max_val = 0;
     
-    // Loop over all internal source image pixels
-    for (row = 0; row < height; row++) {
-        D(fprintf(stderr,"start:row=%d,ic=%d\n",row,ic));
-        for (col = halfFilterWidth; col < width-halfFilterWidth; col++) {
-            // compute the initial neighoboring pixel index to use in the convolution
-            il = ic-halfFilterWidth;
-            sum = 0;
-            ix = 0;
-            
-            // Iterate over all filter pixels
-            D(fprintf(stderr,"il=%d\n", il));
-            for (l=0; l < filterWidth; l++)
-                sum += pgmIn->pixels[il++]*filter->kernel[ix++];
-            
-            // output the value of the convolution in the destination image
-            pixelVal = (int)floor(sum);
-            pgmOut->pixels[ic++] = pixelVal;
-            if (pixelVal > topVal)
-                topVal = pixelVal;
+    for (i = -spanY; i < height+spanY; i++) {
+        loadStripRow(pgmIn, i, spanX, line+spanX);
+        for (j = 0; j < width+2*spanX; j++)
+            lineD[j] = line[j];
+        for (l = 0; l < dimX; l++)
+            taps[l] = lineD+l;
+        for (t = 0; t < rank; t++)
+            kernels->weightedSumRow(filtered+((size_t)t*dimY+(i+spanY)%dimY)*width, taps, rows+t*dimX, dimX, width);
+        
+        // the rows from i-2*spanY to i are loaded: filter along y the output row i-spanY
+        if (i < spanY)
+            continue;
+        for (t = 0; t < rank; t++) {
+            for (k = 0; k < dimY; k++)
+                taps[k] = filtered+((size_t)t*dimY+(i-spanY+k)%dimY)*width;
+            kernels->weightedSumRow(t == 0 ? total : sums, taps, cols+t*dimY, dimY, width);
+            if (t > 0)
+                for (j = 0; j < width; j++)
+                    total[j] += sums[j];
+        }
+        for (j = 0; j < width; j++) {
+            outPixels[j] = (int)floor(total[j]+1e-6);
+            if (outPixels[j] > max_val)
+                max_val = outPixels[j];
         }
-        D(fprintf(stderr,"end:row=%d,ic=%d\n",row,ic));
-        // move the index of the central pixel to the next row
-        ic += halfFilterWidth*2;
+        setRowPGM(out, i-spanY, 0, width, outPixels);
     }
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
     
-    pgmOut->max_val = topVal;
+    free(cols);
+    free(rows);
+    free(line);
+    free(lineD);
+    free(filtered);
+    free(sums);
+    free(total);
+    free(taps);
+    free(outPixels);
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
     return 0;
 }
 
-/*! \fn int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
- * \brief Apply to the image \a pgmIn  a one-dimensional convolution
- * with the Filter \a filter along the image rows.
- * \param pgmIn Pointer to the input Pgm image structure.
- * \param pgmOut Pointer to the output Pgm image structure.
- * \param filter Pointer to the Filter structure.
+/*! \fn int gradientPGM(Pgm* pgmIn, Pgm* pgmOut, int weight, unsigned int phase)
+ * \brief Store in \a pgmOut the magnitude or the phase of the gradient of \a pgmIn computed with
+ *        a Sobel or a Prewitt operator.
+ *
+ * The result is the same of convolution2DPGM() with the horizontal and the vertical filters followed by
+ * modulePGM() or phasePGM(), but the image is read once and the two components are never stored.
+ * The pixels outside the image are computed according to the border policy set by borderPGM().
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param weight The weight of the central taps: 2 for Sobel, 1 for Prewitt.
+ * \param phase Returns the phase if set to 1. Otherwise it returns the magnitude.
  * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
  */
-int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+int gradientPGM(Pgm* pgmIn, Pgm* pgmOut, int weight, unsigned int phase)
 {
-    int row, col, k;
-    double sum;
-    int pixelVal;
-    int topVal = 0;
-    
-    int ix;  // the index in the filter
-    int ic; // the index of the central pixel in the source image
-    int il; // the index of the pixel used in the integration
+    int i;
+    int lo, hi;
+    double loG, hiG;
+    int max_val = 0;
     
     if(!pgmIn)
     {
@@ -506,47 +955,61 @@ int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
         return -1;
     }
     
-    if(!filter) {
-        fprintf(stderr, "Error! No filter defined. Please Check.\n");
-        return -1;
-    }
-    
     int width = pgmIn->width;
     int height = pgmIn->height;
     
-    int filterHeight = filter->height;
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    // The output format is chosen as if the components were stored by fapplyPGM
+    // and then combined by modulePGM or phasePGM
+    haloRangePGM(pgmIn, 1, &lo, &hi);
+    double bound = (2+weight)*((double)hi-lo);
+    rangeFormatPGM(fitFormatPGM(floor(-bound - 1e-6), floor(bound + 1e-6)), &loG, &hiG);
+    PgmFormat format = phase == 1 ? fitFormatPGM(-127, 127) :
+                                    fitFormatPGM(0, hypot(fmax(-loG, hiG), fmax(-loG, hiG)));
+    
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    // Three input rows with a halo pixel on each side, and the output row
+    int* buffer = (int*)malloc((3*(width+2)+width)*sizeof(int));
+    int* top = buffer+1;
+    int* mid = top+width+2;
+    int* bottom = mid+width+2;
+    int* outPixels = bottom+width+1;
+    int* tmp;
+    const KernelSet* kernels = kernelsPGM();
+    int min_val = 0; // only max_val is used
+    
+    loadStripRow(pgmIn, -1, 1, top);
+    loadStripRow(pgmIn, 0, 1, mid);
+    
+    for (i = 0; i < height; i++) {
+        loadStripRow(pgmIn, i+1, 1, bottom);
+        kernels->gradientRow(top, mid, bottom, width, weight, phase, outPixels);
+        kernels->rangeRow(outPixels, width, &min_val, &max_val);
+        setRowPGM(out, i, 0, width, outPixels);
+        
+        // the rows move up by one
+        tmp = top;
+        top = mid;
+        mid = bottom;
+        bottom = tmp;
+    }
     
-    int halfFilterHeight = filterHeight/2;
-    int rowShift = halfFilterHeight*width;
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
     
-    // Move to the first useful interior pixel
-    ic = rowShift;
-    D(fprintf(stderr,"w=%d,h=%d\n",width,height));
+    free(buffer);
     
-    // Loop over all internal source image pixels
-    for (row = halfFilterHeight; row < height-halfFilterHeight; row++) {
-        D(fprintf(stderr,"start:row=%d,ic=%d\n",row,ic));
-        for (col = 0; col < width; col++) {
-            // compute the initial neighoboring pixel index to use in the convolution
-            il = ic-rowShift;
-            sum = 0;
-            ix = 0;
-            // Iterate over all filter pixels
-            for (k=0; k < filterHeight; k++) {
-                D(fprintf(stderr,"k=%d,il=%d\n", k, il));
-                sum += pgmIn->pixels[il]*filter->kernel[ix++];
-                // move the index of the neighboring pixel to the next row
-                il += width;
-            }
-            // output the value of the convolution in the destination image
-            pixelVal = (int)floor(sum);
-            pgmOut->pixels[ic++] = pixelVal;
-            if (pixelVal > topVal)
-                topVal = pixelVal;
-        }
-        D(fprintf(stderr,"end:row=%d,ic=%d\n",row,ic));
-    }
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
-    pgmOut->max_val = topVal;
     return 0;
 }
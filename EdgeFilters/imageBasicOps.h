@@ -19,6 +19,7 @@
 #include <time.h>
 #include "helperFunctions.h"
 #include "imageUtilities.h"
+#include "imageKernels.h"
 #include "imageFilters.h"
 #include "imageFilterOps.h"
 
@@ -27,6 +28,36 @@
  */
 #define drandom() (((double)(random()&0xffffff))/0xffffff)
 
+/*! \def STRIP_ROWS
+ *  \brief Number of rows processed at a time by fapplyPGM()
+ */
+#define STRIP_ROWS 32
+
+/*! \def SEPARABLE_MAX_RANK
+ *  \brief Largest number of separable terms of the kernels convolved by separableConvolutionPGM()
+ */
+#define SEPARABLE_MAX_RANK 4
+
+/*! \def SEPARABLE_TAP_COST
+ *  \brief Cost of a tap of separableConvolutionPGM(), in taps of the direct convolution
+ */
+#define SEPARABLE_TAP_COST 2.5
+
+/*! \def SEPARABLE_ROW_COST
+ *  \brief Cost per pixel of the passes of separableConvolutionPGM(), in taps of the direct convolution
+ */
+#define SEPARABLE_ROW_COST 60
+
+/*! \enum BorderPolicy
+ * \brief How the pixels outside the image borders are computed by fapplyPGM.
+ */
+typedef enum
+{
+    BORDER_REPLICATE, /*!< Repeat the nearest border pixel */
+    BORDER_REFLECT,   /*!< Mirror the image around the border pixel (which is not repeated) */
+    BORDER_CONSTANT   /*!< Use a constant value */
+} BorderPolicy;
+
 //---------------------------------------------------------//
 //------------- Basic image operations for PGM ------------//
 //---------------------------------------------------------//
@@ -40,9 +71,19 @@ int comparePGM(Pgm* pgmOp1, Pgm* pgmOp2);
 //---------------------------------------------------------//
 int modulePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut);
 int phasePGM(Pgm* pgmOpX, Pgm* pgmOpY, Pgm* pgmOut);
+int gradientPGM(Pgm* pgmIn, Pgm* pgmOut, int weight, unsigned int phase);
 
+void borderPGM(BorderPolicy policy, int value);
+void haloRangePGM(Pgm* pgm, int halo, int* min, int* max);
+int borderIndex(int i, int n);
+void haloRow(int* dst, int width, int spanX, int outside);
+void loadStripRow(Pgm* pgm, int row, int spanX, int* dst);
+void loadSpanRow(Pgm* pgm, int row, int col, int len, int* dst);
+PgmFormat kernelFormatPGM(Pgm* pgm, double* kernel, int dimX, int dimY);
 int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
             int (*func)(Pgm*, Pgm*, double*, int, int, int));
+int stripApplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, int dimY,
+                  int (*func)(Pgm*, Pgm*, double*, int, int, int), void (*rowFunc)(Pgm*, double*, int, int, int, int*));
 
 //---------------------------------------------------------//
 //---------------------   Convolutions  -------------------//
@@ -50,5 +91,7 @@ int fapplyPGM(Pgm* pgmIn1, Pgm* pgmIn2, Pgm* pgmOut, Filter* filter, int dimX, i
 int convolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter);
 int convolution1DXPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter);
 int convolution1DYPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter);
+int separableConvolutionPays(Filter* filter);
+int separableConvolutionPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter);
 
 #endif /* imageBasicOps_h */
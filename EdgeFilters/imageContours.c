@@ -34,23 +34,24 @@ int contourUniformKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, in
     spanX = 1;
     spanY = 1;
     
-    int exp_int = pgmIn1->pixels[ic]*9;
+    int* pixels = pgmIn1->pixels;
+    int exp_int = pixels[ic]*9;
     
-    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
     
     int sum = 0;
 
     // Iterate over all filter pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
+    for (k=-spanY, il = ic-stride*spanY; k <= spanY; k++, il += stride)
         for (l=-spanX; l <= spanX; l++)
             // Compute the integral of the neighborhood
-            sum += abs(pgmIn1->pixels[il+l]);
+            sum += abs(pixels[il+l]);
     
     if (sum == exp_int)
         // The pixel is not a contour pixel and the output value is 0
         return 0;
     
-    return pgmIn1->pixels[ic];
+    return pixels[ic];
 }
 
 /*! \fn int contourUniformPGM(Pgm* pgmIn, Pgm* pgmOut)
@@ -64,7 +65,7 @@ int contourUniformKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, in
  */
 int contourUniformPGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 0, 0, contourUniformKernel);
+    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 3, 3, contourUniformKernel);
 }
 
 /*! \fn int contourN8IntKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
@@ -87,17 +88,18 @@ int contourN8IntKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int
     spanY = 1;
     
     int bck = pgmIn1->max_val;
+    int* pixels = pgmIn1->pixels;
     
     // skip background pixels
-    if  (pgmIn1->pixels[ic] == bck )
+    if  (pixels[ic] == bck )
         return 255;
     
-    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
     
     // Iterate over all filter pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
+    for (k=-spanY, il = ic-stride*spanY; k <= spanY; k++, il += stride)
         for (l=-spanX; l <= spanX; l++)
-            if (pgmIn1->pixels[il+l] == bck)
+            if (pixels[il+l] == bck)
                 // There is at least one background pixel
                 return 0;
     
@@ -117,37 +119,46 @@ int contourN8IntKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int
  */
 int contourN8IntPGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 1, 1, contourN8IntKernel);
+    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 3, 3, contourN8IntKernel);
 }
 
-/*! \fn void connectivityKernel(Pgm *pgmNH, Pgm* pgmNL, Pgm* pgmOut, int ic)
+/*! \fn void connectivityKernel(Pgm *pgmNH, Pgm* pgmNL, Pgm* pgmOut, int row, int col)
  * \brief It returns in \a pgmOut the pixels of \a pgmNL 8-connected to
  *        the central pixel of \a pgmNH.
  *
  * Find and store in \a pgmOut the pixels of \a pgmNL that are 8-connected to a non background pixel in \a pgmNH.
- * It only searches for pixels in an 8-neighboorhood centered on the pixel in \a pgmNH linearly indexed by \a ic.
+ * It only searches for pixels in an 8-neighboorhood centered on the pixel in \a pgmNH at (\a row, \a col).
+ * The neighborhood is clipped at the image borders.
  * \param pgmNH Pointer to the input Pgm image structure.
  * \param pgmNL Pointer to the input Pgm image structure.
  * \param pgmOut Pointer to the Pgm image structure that stores the result.
- * \param ic Linear index in pgmNH->pixels of the central pixel.
+ * \param row The row of the central pixel.
+ * \param col The column of the central pixel.
  */
-void connectivityKernel(Pgm *pgmNH, Pgm* pgmNL, Pgm* pgmOut, int ic)
+void connectivityKernel(Pgm *pgmNH, Pgm* pgmNL, Pgm* pgmOut, int row, int col)
 {
-    int k, l, il;
-    if ((pgmOut->pixels[ic] = pgmNH->pixels[ic])==0)
+    int k, l;
+    int pixel = getPixelPGM(pgmNH, row*pgmNH->stride+col);
+    
+    setPixelPGM(pgmOut, row*pgmOut->stride+col, pixel);
+    if (pixel == 0)
         return;
 
     int spanX = 1;
     int spanY = 1;
     
-    int width = pgmNL->width;
+    // Clip the neighborhood to the image
+    int top = row-spanY < 0 ? 0 : row-spanY;
+    int bottom = row+spanY >= pgmNL->height ? pgmNL->height-1 : row+spanY;
+    int left = col-spanX < 0 ? 0 : col-spanX;
+    int right = col+spanX >= pgmNL->width ? pgmNL->width-1 : col+spanX;
     
     // Iterate over all N8 set in NL pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
-        for (l=-spanX; l <= spanX; l++)
+    for (k = top; k <= bottom; k++)
+        for (l = left; l <= right; l++)
             // If the pixel is different from 0 it is connected
-            if (pgmNL->pixels[il+l] != 0)
-                pgmOut->pixels[il+l] = 255;
+            if (getPixelPGM(pgmNL, k*pgmNL->stride+l) != 0)
+                setPixelPGM(pgmOut, k*pgmOut->stride+l, 255);
 }
 
 /*! \fn int connectivityPGM(Pgm *pgmNH, Pgm *pgmNL, Pgm *pgmOut)
@@ -165,7 +176,6 @@ void connectivityKernel(Pgm *pgmNH, Pgm* pgmNL, Pgm* pgmOut, int ic)
 int connectivityPGM(Pgm *pgmNH, Pgm *pgmNL, Pgm *pgmOut)
 {
     int row, col;
-    int ic; // the index of the central pixel in the source image
     
     if(!pgmNH || !pgmNL)
     {
@@ -182,29 +192,21 @@ int connectivityPGM(Pgm *pgmNH, Pgm *pgmNL, Pgm *pgmOut)
     int width = pgmNH->width;
     int height = pgmNH->height;
     
-    int borderX = 1;
-    int borderY = 1;
-    
     // Timestamp
     struct timeval tvStart;
     gettimeofday(&tvStart, NULL);
     
-    // Move to the first useful interior pixel
-    ic = borderY*width+borderX;
     D(fprintf(stderr,"w=%d,h=%d\n",width,height));
-    D(fprintf(stderr,"bw=%d,bh=%d\n",borderX,borderY));
     
-    // Loop over all internal source image pixels
-    for (row = borderY; row < height-borderY; row++, ic += borderX*2) {
-        D(fprintf(stderr,"start:row=%d,ic=%d\n",row,ic));
-        for (col = borderX; col < width-borderX; col++, ic++) {
-            D(fprintf(stderr,"(%d,%d),ic=%d\n", row, col, ic));
+    // Loop over all source image pixels
+    for (row = 0; row < height; row++) {
+        D(fprintf(stderr,"start:row=%d\n",row));
+        for (col = 0; col < width; col++) {
+            D(fprintf(stderr,"(%d,%d)\n", row, col));
             
             // Apply the function to each pixel neighborhood
-            connectivityKernel(pgmNH, pgmNL, pgmOut, ic);
+            connectivityKernel(pgmNH, pgmNL, pgmOut, row, col);
         }
-        D(fprintf(stderr,"end:row=%d,ic=%d\n",row,ic));
-        // move the index of the central pixel to the next row
     }
     
     pgmOut->max_val = pgmNH->max_val;
@@ -217,4 +219,993 @@ int connectivityPGM(Pgm *pgmNH, Pgm *pgmNL, Pgm *pgmOut)
                                                     ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
     return 0;
-}
\ No newline at end of file
+}
+/*! \struct HysteresisBand
+ * \brief A band of rows labeled by one thread of hysteresisPGM().
+ */
+typedef struct
+{
+    Pgm* pgmIn;              /*!< The image to threshold */
+    Pgm* pgmOut;             /*!< The image of the edges */
+    int first;               /*!< The first row of the band */
+    int last;                /*!< The row after the last one of the band */
+    int low;                 /*!< The pixels from this value are candidate edges */
+    int high;                /*!< The pixels from this value are strong edges */
+    unsigned char* classes;  /*!< 0 for the background, 1 for weak and 2 for strong pixels, and for the components at their roots */
+    int* parent;             /*!< The parent of each pixel in the union-find forest of the components */
+} HysteresisBand;
+
+/*! \fn int findRoot(int* parent, int p)
+ * \brief Return the root of the pixel \a p in the union-find forest \a parent, halving the path to it.
+ */
+int findRoot(int* parent, int p)
+{
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    
+    return p;
+}
+
+/*! \fn void hysteresisUnion(int* parent, unsigned char* classes, int a, int b)
+ * \brief Merge the components of the pixels \a a and \a b. The root is the one with the lowest index and
+ *        it is strong if either component is strong.
+ */
+void hysteresisUnion(int* parent, unsigned char* classes, int a, int b)
+{
+    int tmp;
+    
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b)
+        return;
+    if (a > b) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    parent[b] = a;
+    if (classes[b] > classes[a])
+        classes[a] = classes[b];
+}
+
+/*! \fn void* hysteresisLabelBand(void* arg)
+ * \brief Classify the pixels of a HysteresisBand and join the 8-connected candidate pixels inside the band.
+ */
+void* hysteresisLabelBand(void* arg)
+{
+    HysteresisBand* band = (HysteresisBand*)arg;
+    int row, col, p;
+    int width = band->pgmIn->width;
+    unsigned char* classes = band->classes;
+    int* parent = band->parent;
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for (row = band->first; row < band->last; row++) {
+        getRowPGM(band->pgmIn, row, 0, width, pixels);
+        for (col = 0, p = row*width; col < width; col++, p++) {
+            classes[p] = pixels[col] >= band->high ? 2 : pixels[col] >= band->low ? 1 : 0;
+            parent[p] = p;
+            if (classes[p] == 0)
+                continue;
+            // the neighbors already visited: left, and the three above if they are in the band
+            if (col > 0 && classes[p-1])
+                hysteresisUnion(parent, classes, p, p-1);
+            if (row == band->first)
+                continue;
+            if (col > 0 && classes[p-width-1])
+                hysteresisUnion(parent, classes, p, p-width-1);
+            if (classes[p-width])
+                hysteresisUnion(parent, classes, p, p-width);
+            if (col < width-1 && classes[p-width+1])
+                hysteresisUnion(parent, classes, p, p-width+1);
+        }
+    }
+    
+    free(pixels);
+    
+    return NULL;
+}
+
+/*! \fn void* hysteresisEdgeBand(void* arg)
+ * \brief Store the edges of a HysteresisBand: the candidate pixels whose component has a strong pixel.
+ *
+ * The forest is only read, since the other bands are searching it at the same time.
+ */
+void* hysteresisEdgeBand(void* arg)
+{
+    HysteresisBand* band = (HysteresisBand*)arg;
+    int row, col, p, root;
+    int width = band->pgmIn->width;
+    unsigned char* classes = band->classes;
+    int* parent = band->parent;
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for (row = band->first; row < band->last; row++) {
+        for (col = 0, p = row*width; col < width; col++, p++) {
+            for (root = p; parent[root] != root; root = parent[root])
+                ;
+            pixels[col] = classes[p] && classes[root] == 2 ? 255 : 0;
+        }
+        setRowPGM(band->pgmOut, row, 0, width, pixels);
+    }
+    
+    free(pixels);
+    
+    return NULL;
+}
+
+/*! \fn int countBands(int height)
+ * \brief Return the number of bands of rows of an image of \a height rows processed in parallel: one for each
+ *        processor, of at least BAND_MIN_ROWS rows.
+ */
+int countBands(int height)
+{
+    int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (n > height/BAND_MIN_ROWS)
+        n = height/BAND_MIN_ROWS;
+    
+    return n < 1 ? 1 : n;
+}
+
+/*! \fn void runBands(void* bands, size_t size, int n, void* (*func)(void*))
+ * \brief Apply \a func to the \a n bands, structures of \a size bytes in the array \a bands, each one in its own thread.
+ */
+void runBands(void* bands, size_t size, int n, void* (*func)(void*))
+{
+    int k;
+    pthread_t* threads = (pthread_t*)malloc(n*sizeof(pthread_t));
+    int* started = (int*)calloc(n, sizeof(int));
+    
+    for (k = 1; k < n; k++) {
+        started[k] = pthread_create(&threads[k], NULL, func, (char*)bands+k*size) == 0;
+        // run the band here if there are no more threads
+        if (!started[k])
+            func((char*)bands+k*size);
+    }
+    func(bands);
+    for (k = 1; k < n; k++)
+        if (started[k])
+            pthread_join(threads[k], NULL);
+    
+    free(threads);
+    free(started);
+}
+
+/*! \fn int hysteresisPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold_low, int threshold_high)
+ * \brief Store in \a pgmOut the edges of \a pgmIn found by hysteresis thresholding.
+ *
+ * The pixels from \a threshold_high are strong edges, and the pixels from \a threshold_low are edges if they are
+ * 8-connected to a strong edge through other such pixels, however long the chain. The image is split in bands
+ * by countBands(), whose candidate pixels are joined in components
+ * by union-find in parallel. The components that touch across the borders of the bands are then joined, and
+ * the pixels of the components with a strong pixel are stored, again in parallel. The cost is linear in the
+ * number of pixels. Negative thresholds are equivalent to 0.
+ * \param pgmIn Pointer to the input PGM image structure, typically the output of cannyPGM().
+ * \param pgmOut Pointer to the output PGM image structure: 255 for the edges, 0 otherwise.
+ * \param threshold_low Lower threshold.
+ * \param threshold_high Higher threshold.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int hysteresisPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold_low, int threshold_high)
+{
+    int k, col, p;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    
+    // Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    threshold_low = threshold_low < 0 ? 0 : threshold_low;
+    threshold_high = threshold_high < 0 ? 0 : threshold_high;
+    
+    int n = countBands(height);
+    // the full frame buffers come from the scratch arena, as the images do
+    unsigned char* classes = (unsigned char*)getBufferPGM((size_t)width*height);
+    int* parent = (int*)getBufferPGM((size_t)width*height*sizeof(int));
+    Pgm* out = targetPGM(pgmOut, PGM_U8, pgmOut == pgmIn);
+    HysteresisBand* bands = (HysteresisBand*)malloc(n*sizeof(HysteresisBand));
+    for (k = 0; k < n; k++) {
+        bands[k].pgmIn = pgmIn;
+        bands[k].pgmOut = out;
+        bands[k].first = (int)((long long)height*k/n);
+        bands[k].last = (int)((long long)height*(k+1)/n);
+        // the weak pixels include the strong ones
+        bands[k].low = threshold_low < threshold_high ? threshold_low : threshold_high;
+        bands[k].high = threshold_high;
+        bands[k].classes = classes;
+        bands[k].parent = parent;
+    }
+    
+    runBands(bands, sizeof(HysteresisBand), n, hysteresisLabelBand);
+    
+    // join the components across the first row of each band and the last row of the previous one
+    for (k = 1; k < n; k++)
+        for (col = 0, p = bands[k].first*width; col < width; col++, p++) {
+            if (classes[p] == 0)
+                continue;
+            if (col > 0 && classes[p-width-1])
+                hysteresisUnion(parent, classes, p, p-width-1);
+            if (classes[p-width])
+                hysteresisUnion(parent, classes, p, p-width);
+            if (col < width-1 && classes[p-width+1])
+                hysteresisUnion(parent, classes, p, p-width+1);
+        }
+    
+    runBands(bands, sizeof(HysteresisBand), n, hysteresisEdgeBand);
+    
+    storePGM(out, pgmOut);
+    pgmOut->max_val = 255;
+    
+    putBufferPGM(classes, (size_t)width*height);
+    putBufferPGM(parent, (size_t)width*height*sizeof(int));
+    free(bands);
+    
+    // Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+                                                    ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return 0;
+}
+
+/*! \struct LabelBand
+ * \brief A band of rows labeled by one thread of labelPGM().
+ */
+typedef struct
+{
+    Pgm* pgmIn;              /*!< The image to label */
+    Pgm* pgmOut;             /*!< The image of the labels */
+    int first;               /*!< The first row of the band */
+    int last;                /*!< The row after the last one of the band */
+    int connectivity;        /*!< 4 or 8 */
+    int* parent;             /*!< The parent of each pixel in the union-find forest, -1 for the background */
+    int count;               /*!< The number of components whose first pixel is in the band */
+    int offset;              /*!< The number of components whose first pixel is in the bands before this one */
+} LabelBand;
+
+/*! \fn int labelUnion(int* parent, int a, int b)
+ * \brief Merge the components of the pixels \a a and \a b and return the root, the one with the lowest index.
+ */
+int labelUnion(int* parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    
+    return b;
+}
+
+/*! \fn void* labelScanBand(void* arg)
+ * \brief Join the connected foreground pixels inside a LabelBand.
+ *
+ * The neighbors already visited are checked with a decision tree: for 8-connectivity the pixel above (b)
+ * is connected to the ones above-left (a), above-right (c) and left (d), so it is enough to join it. Otherwise
+ * c is joined with a or d, since these are not connected to it, and a and d are each enough alone.
+ */
+void* labelScanBand(void* arg)
+{
+    LabelBand* band = (LabelBand*)arg;
+    int row, col, p;
+    int width = band->pgmIn->width;
+    int* parent = band->parent;
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for (row = band->first; row < band->last; row++) {
+        getRowPGM(band->pgmIn, row, 0, width, pixels);
+        for (col = 0, p = row*width; col < width; col++, p++) {
+            if (pixels[col] == 0) {
+                parent[p] = -1;
+                continue;
+            }
+            parent[p] = p;
+            // the rows above the band belong to another thread
+            if (row == band->first) {
+                if (col > 0 && parent[p-1] >= 0)
+                    parent[p] = findRoot(parent, p-1);
+            } else if (band->connectivity == 4) {
+                if (parent[p-width] >= 0)
+                    parent[p] = findRoot(parent, p-width);
+                if (col > 0 && parent[p-1] >= 0)
+                    labelUnion(parent, p, p-1);
+            } else if (parent[p-width] >= 0)
+                parent[p] = findRoot(parent, p-width);
+            else if (col < width-1 && parent[p-width+1] >= 0) {
+                parent[p] = findRoot(parent, p-width+1);
+                if (col > 0 && parent[p-width-1] >= 0)
+                    labelUnion(parent, p, p-width-1);
+                else if (col > 0 && parent[p-1] >= 0)
+                    labelUnion(parent, p, p-1);
+            } else if (col > 0 && parent[p-width-1] >= 0)
+                parent[p] = findRoot(parent, p-width-1);
+            else if (col > 0 && parent[p-1] >= 0)
+                parent[p] = findRoot(parent, p-1);
+        }
+    }
+    
+    free(pixels);
+    
+    return NULL;
+}
+
+/*! \fn void* labelCountBand(void* arg)
+ * \brief Number in raster order the roots of the components in a LabelBand, from 1.
+ *
+ * The number n of a root is stored as -n-1 in its parent, so that it is still distinguished from the other
+ * foreground pixels, and the background (-1) reads as 0.
+ */
+void* labelCountBand(void* arg)
+{
+    LabelBand* band = (LabelBand*)arg;
+    int p;
+    int width = band->pgmIn->width;
+    int* parent = band->parent;
+    
+    band->count = 0;
+    for (p = band->first*width; p < band->last*width; p++)
+        if (parent[p] == p)
+            parent[p] = -(++band->count)-1;
+    
+    return NULL;
+}
+
+/*! \fn void* labelStoreBand(void* arg)
+ * \brief Store the labels of a LabelBand: the number of the root of each pixel plus the offset of its band.
+ *
+ * The forest is only read, since the other bands are searching it at the same time. The root has the lowest
+ * index of the component, so it lies in the band of the pixel or in one before it.
+ */
+void* labelStoreBand(void* arg)
+{
+    LabelBand* band = (LabelBand*)arg;
+    int row, col, p, root;
+    LabelBand* owner;
+    int width = band->pgmIn->width;
+    int* parent = band->parent;
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for (row = band->first; row < band->last; row++) {
+        for (col = 0, p = row*width; col < width; col++, p++) {
+            if (parent[p] == -1) {
+                pixels[col] = 0;
+                continue;
+            }
+            for (root = p; parent[root] >= 0; root = parent[root])
+                ;
+            for (owner = band; owner->first*width > root; owner--)
+                ;
+            pixels[col] = -parent[root]-1 + owner->offset;
+        }
+        setRowPGM(band->pgmOut, row, 0, width, pixels);
+    }
+    
+    free(pixels);
+    
+    return NULL;
+}
+
+/*! \fn int labelPGM(Pgm* pgmIn, Pgm* pgmOut, int connectivity, Component** components)
+ * \brief Store in \a pgmOut the labels of the connected components of the nonzero pixels of \a pgmIn.
+ *
+ * The components are numbered from 1 in raster order of their first pixel, and the background is 0. The
+ * image is split in bands by countBands(), scanned in parallel with a decision tree that joins each pixel
+ * to the components of its neighbors already visited by union-find. The components that touch across the
+ * borders of the bands are then joined, and the labels are counted and stored, again in parallel.
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure, in the narrowest format for the labels.
+ * \param connectivity 4 or 8 (any other value).
+ * \param components If not NULL, it is set to an array, to free, with the area and the bounding box of
+ *        each component, the one with label l at index l-1.
+ * \return The number of components on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int labelPGM(Pgm* pgmIn, Pgm* pgmOut, int connectivity, Component** components)
+{
+    int k, row, col, p, count;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    
+    // Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    int n = countBands(height);
+    // the full frame buffer comes from the scratch arena, as the images do
+    int* parent = (int*)getBufferPGM((size_t)width*height*sizeof(int));
+    LabelBand* bands = (LabelBand*)malloc(n*sizeof(LabelBand));
+    for (k = 0; k < n; k++) {
+        bands[k].pgmIn = pgmIn;
+        bands[k].first = (int)((long long)height*k/n);
+        bands[k].last = (int)((long long)height*(k+1)/n);
+        bands[k].connectivity = connectivity == 4 ? 4 : 8;
+        bands[k].parent = parent;
+    }
+    
+    runBands(bands, sizeof(LabelBand), n, labelScanBand);
+    
+    // join the components across the first row of each band and the last row of the previous one
+    for (k = 1; k < n; k++)
+        for (col = 0, p = bands[k].first*width; col < width; col++, p++) {
+            if (parent[p] < 0)
+                continue;
+            if (parent[p-width] >= 0)
+                labelUnion(parent, p, p-width);
+            else if (bands[k].connectivity == 8) {
+                if (col > 0 && parent[p-width-1] >= 0)
+                    labelUnion(parent, p, p-width-1);
+                if (col < width-1 && parent[p-width+1] >= 0)
+                    labelUnion(parent, p, p-width+1);
+            }
+        }
+    
+    runBands(bands, sizeof(LabelBand), n, labelCountBand);
+    
+    for (k = 0, count = 0; k < n; k++) {
+        bands[k].offset = count;
+        count += bands[k].count;
+    }
+    
+    // the input is not read anymore
+    Pgm* out = targetPGM(pgmOut, fitFormatPGM(0, count), 0);
+    for (k = 0; k < n; k++)
+        bands[k].pgmOut = out;
+    
+    runBands(bands, sizeof(LabelBand), n, labelStoreBand);
+    
+    pgmOut->max_val = count > 0 ? count : 1;
+    
+    putBufferPGM(parent, (size_t)width*height*sizeof(int));
+    free(bands);
+    
+    if (components) {
+        *components = (Component*)malloc((count > 0 ? count : 1)*sizeof(Component));
+        for (k = 0; k < count; k++) {
+            (*components)[k].area = 0;
+            (*components)[k].left = width;
+            (*components)[k].right = -1;
+        }
+        int* pixels = (int*)malloc(width*sizeof(int));
+        for (row = 0; row < height; row++) {
+            getRowPGM(pgmOut, row, 0, width, pixels);
+            for (col = 0; col < width; col++) {
+                if (pixels[col] == 0)
+                    continue;
+                Component* c = &(*components)[pixels[col]-1];
+                if (c->area++ == 0)
+                    c->top = row;
+                c->bottom = row;
+                if (col < c->left)
+                    c->left = col;
+                if (col > c->right)
+                    c->right = col;
+            }
+        }
+        free(pixels);
+    }
+    
+    // Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+                                                    ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return count;
+}
+
+/*! \fn int writeComponents(Component* components, int count, char* filename)
+ * \brief Write to the text file \a filename a line with the label, the area and the bounding box (left, top,
+ *        right and bottom) of each of the \a count components returned by labelPGM().
+ * \return 0 on success, -1 if the file cannot be written.
+ */
+int writeComponents(Component* components, int count, char* filename)
+{
+    int k;
+    FILE* fp = fopen(filename, "w");
+    
+    if(fp == NULL)
+    {
+        fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+        return -1;
+    }
+    
+    for (k = 0; k < count; k++)
+        fprintf(fp, "%d %d %d %d %d %d\n", k+1, components[k].area, components[k].left, components[k].top,
+                components[k].right, components[k].bottom);
+    fclose(fp);
+    
+    return 0;
+}
+
+/*! \var chainDX
+ * \brief Column step of each Freeman chain code: 0 is east and the codes turn counterclockwise by 45 degrees.
+ */
+const static int chainDX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+/*! \var chainDY
+ * \brief Row step of each Freeman chain code (rows grow downwards, so 2 is north).
+ */
+const static int chainDY[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+
+/*! \struct BorderMarks
+ * \brief Open addressing hash map from the linear index of the border pixels visited by traceContoursPGM()
+ *        to their marks, so that the memory grows with the number of border pixels and not with the image.
+ */
+typedef struct
+{
+    int size;     /*!< Number of slots, a power of 2 */
+    int count;    /*!< Number of marked pixels */
+    int* keys;    /*!< Linear index of the pixel in each slot, -1 if the slot is empty */
+    int* marks;   /*!< Mark of the pixel in each slot */
+} BorderMarks;
+
+/*! \fn int getMark(BorderMarks* marks, int p)
+ * \brief Return the mark of the pixel \a p, 0 if it has none.
+ */
+int getMark(BorderMarks* marks, int p)
+{
+    int slot = (int)(((unsigned int)p*2654435761u) & (marks->size-1));
+    
+    while (marks->keys[slot] != -1) {
+        if (marks->keys[slot] == p)
+            return marks->marks[slot];
+        slot = (slot + 1) & (marks->size-1);
+    }
+    
+    return 0;
+}
+
+/*! \fn void setMark(BorderMarks* marks, int p, int mark)
+ * \brief Set to \a mark the mark of the pixel \a p, doubling the slots when they are half full.
+ */
+void setMark(BorderMarks* marks, int p, int mark)
+{
+    int k, slot;
+    
+    if (2*(marks->count+1) > marks->size) {
+        BorderMarks old = *marks;
+        marks->size *= 2;
+        marks->count = 0;
+        marks->keys = (int*)malloc(marks->size*sizeof(int));
+        marks->marks = (int*)malloc(marks->size*sizeof(int));
+        memset(marks->keys, -1, marks->size*sizeof(int));
+        for (k = 0; k < old.size; k++)
+            if (old.keys[k] != -1)
+                setMark(marks, old.keys[k], old.marks[k]);
+        free(old.keys);
+        free(old.marks);
+    }
+    
+    slot = (int)(((unsigned int)p*2654435761u) & (marks->size-1));
+    while (marks->keys[slot] != -1 && marks->keys[slot] != p)
+        slot = (slot + 1) & (marks->size-1);
+    if (marks->keys[slot] == -1) {
+        marks->keys[slot] = p;
+        marks->count++;
+    }
+    marks->marks[slot] = mark;
+}
+
+/*! \fn int nonzeroPixel(Pgm* pgm, int row, int col)
+ * \brief Return 1 if the pixel at (\a row, \a col) is inside the image and not 0.
+ */
+int nonzeroPixel(Pgm* pgm, int row, int col)
+{
+    if (row < 0 || row >= pgm->height || col < 0 || col >= pgm->width)
+        return 0;
+    
+    return getPixelPGM(pgm, row*pgm->stride+col) != 0;
+}
+
+/*! \fn void addChainCode(Contours* contours, int code)
+ * \brief Append \a code to the chain codes of the last contour of \a contours.
+ */
+void addChainCode(Contours* contours, int code)
+{
+    if (contours->size == contours->capacity) {
+        contours->capacity *= 2;
+        contours->codes = (unsigned char*)realloc(contours->codes, contours->capacity);
+    }
+    contours->codes[contours->size++] = (unsigned char)code;
+    contours->contours[contours->count-1].length++;
+}
+
+/*! \fn Contours* traceContoursPGM(Pgm* pgmIn)
+ * \brief Return the borders of the 8-connected components of the nonzero pixels of \a pgmIn, and of their holes,
+ *        as chain codes.
+ *
+ * Implements the border following of Suzuki and Abe: a single raster scan finds the first pixel of each outer
+ * and hole border not yet followed, follows the border counterclockwise and marks its pixels with the number
+ * of the border, so that the scan does not start it again and knows the border enclosing the following ones.
+ * The marks are kept in a hash map, so the memory used besides the image grows with the number of border
+ * pixels. Each contour starts from its first pixel in raster order and its chain codes lead back to it.
+ * \param pgmIn Pointer to the input PGM image structure, typically thresholded.
+ * \return Pointer to the Contours structure, to free with freeContours(), or NULL if pgmIn is NULL.
+ */
+Contours* traceContoursPGM(Pgm* pgmIn)
+{
+    int row, col, mark, hole, nbd, lnbd, k, d, d2, row1, col1, row3, col3, row4, col4, east;
+    Contour* contour;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return NULL;
+    }
+    
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    
+    // Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    Contours* contours = (Contours*)malloc(sizeof(Contours));
+    contours->width = width;
+    contours->height = height;
+    contours->count = 0;
+    contours->room = 64;
+    contours->contours = (Contour*)malloc(contours->room*sizeof(Contour));
+    contours->size = 0;
+    contours->capacity = 1024;
+    contours->codes = (unsigned char*)malloc(contours->capacity);
+    
+    BorderMarks marks;
+    marks.size = 1024;
+    marks.count = 0;
+    marks.keys = (int*)malloc(marks.size*sizeof(int));
+    marks.marks = (int*)malloc(marks.size*sizeof(int));
+    memset(marks.keys, -1, marks.size*sizeof(int));
+    
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for (row = 0; row < height; row++) {
+        getRowPGM(pgmIn, row, 0, width, pixels);
+        // the frame of the image is the border 1
+        lnbd = 1;
+        for (col = 0; col < width; col++) {
+            if (pixels[col] == 0)
+                continue;
+            mark = getMark(&marks, row*width+col);
+            
+            // an outer border starts at a pixel not yet followed after a 0 pixel, and a hole border at a
+            // pixel not on the right side of a border already followed before a 0 pixel
+            if (mark == 0 && (col == 0 || pixels[col-1] == 0)) {
+                hole = 0;
+                d2 = 4;
+            } else if (mark >= 0 && (col == width-1 || pixels[col+1] == 0)) {
+                hole = 1;
+                d2 = 0;
+                if (mark > 0)
+                    lnbd = mark;
+            } else {
+                if (mark != 0)
+                    lnbd = abs(mark);
+                continue;
+            }
+            
+            if (contours->count == contours->room) {
+                contours->room *= 2;
+                contours->contours = (Contour*)realloc(contours->contours, contours->room*sizeof(Contour));
+            }
+            nbd = contours->count + 2;
+            contour = &contours->contours[contours->count++];
+            contour->x = col;
+            contour->y = row;
+            contour->hole = hole;
+            contour->length = 0;
+            contour->first = contours->size;
+            // the parent is the border met last by the scan, or its parent if they are of the same kind
+            if (lnbd == 1)
+                contour->parent = -1;
+            else if (contours->contours[lnbd-2].hole == hole)
+                contour->parent = contours->contours[lnbd-2].parent;
+            else
+                contour->parent = lnbd-2;
+            
+            // look clockwise from the 0 pixel for the last pixel of the border
+            for (k = 0; k < 8; k++) {
+                d = (d2 - k) & 7;
+                if (nonzeroPixel(pgmIn, row+chainDY[d], col+chainDX[d]))
+                    break;
+            }
+            if (k == 8) {
+                // an isolated pixel
+                setMark(&marks, row*width+col, -nbd);
+                lnbd = nbd;
+                continue;
+            }
+            
+            row1 = row + chainDY[d];
+            col1 = col + chainDX[d];
+            row3 = row;
+            col3 = col;
+            while (1) {
+                // look counterclockwise from the previous pixel for the next one
+                east = 0;
+                for (k = 1; k <= 8; k++) {
+                    d = (d2 + k) & 7;
+                    if (nonzeroPixel(pgmIn, row3+chainDY[d], col3+chainDX[d]))
+                        break;
+                    if (d == 0)
+                        east = 1;
+                }
+                if (east)
+                    setMark(&marks, row3*width+col3, -nbd);
+                else if (getMark(&marks, row3*width+col3) == 0)
+                    setMark(&marks, row3*width+col3, nbd);
+                addChainCode(contours, d);
+                
+                row4 = row3 + chainDY[d];
+                col4 = col3 + chainDX[d];
+                if (row4 == row && col4 == col && row3 == row1 && col3 == col1)
+                    break;
+                d2 = (d + 4) & 7;
+                row3 = row4;
+                col3 = col4;
+            }
+            lnbd = abs(getMark(&marks, row*width+col));
+        }
+    }
+    
+    free(pixels);
+    free(marks.keys);
+    free(marks.marks);
+    
+    // Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+                                                    ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return contours;
+}
+
+/*! \fn void freeContours(Contours** contours)
+ * \brief Free the Contours structure returned by traceContoursPGM() and set the pointer to NULL.
+ */
+void freeContours(Contours** contours)
+{
+    if (*contours == NULL)
+        return;
+    
+    free((*contours)->contours);
+    free((*contours)->codes);
+    free(*contours);
+    *contours = NULL;
+}
+
+/*! \fn void writeInt32(FILE* fp, int value)
+ * \brief Write \a value to \a fp as 4 bytes, the least significant first.
+ */
+void writeInt32(FILE* fp, int value)
+{
+    unsigned char bytes[4];
+    
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    bytes[2] = (unsigned char)(value >> 16);
+    bytes[3] = (unsigned char)(value >> 24);
+    fwrite(bytes, 1, 4, fp);
+}
+
+/*! \fn int writeContours(Contours* contours, char* filename)
+ * \brief Write the contours found by traceContoursPGM() to the binary file \a filename.
+ *
+ * The file starts with the 4 characters "CHN1" and the width, the height and the number of contours. Each
+ * contour follows with its first point (column and row), the index of its parent (-1 for the image frame),
+ * 1 for a hole or 0 for an outer border and the number of chain codes, and then the chain codes, one byte each.
+ * All numbers are 32 bit integers with the least significant byte first.
+ * \return 0 on success, -1 if the file cannot be written.
+ */
+int writeContours(Contours* contours, char* filename)
+{
+    int k;
+    Contour* contour;
+    FILE* fp = fopen(filename, "wb");
+    
+    if(fp == NULL)
+    {
+        fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+        return -1;
+    }
+    
+    fwrite("CHN1", 1, 4, fp);
+    writeInt32(fp, contours->width);
+    writeInt32(fp, contours->height);
+    writeInt32(fp, contours->count);
+    for (k = 0; k < contours->count; k++) {
+        contour = &contours->contours[k];
+        writeInt32(fp, contour->x);
+        writeInt32(fp, contour->y);
+        writeInt32(fp, contour->parent);
+        writeInt32(fp, contour->hole);
+        writeInt32(fp, contour->length);
+        fwrite(contours->codes + contour->first, 1, contour->length, fp);
+    }
+    fclose(fp);
+    
+    return 0;
+}
+
+/*! \fn void writeVarint(FILE* fp, unsigned int value)
+ * \brief Write \a value to \a fp in 7 bit groups, the least significant first, with the high bit set on all the
+ *        bytes but the last.
+ */
+void writeVarint(FILE* fp, unsigned int value)
+{
+    while (value >= 0x80) {
+        putc((int)(value & 0x7f) | 0x80, fp);
+        value >>= 7;
+    }
+    putc((int)value, fp);
+}
+
+/*! \fn void edgeGradient(int** window, double* kernelX, double* kernelY, int col, int* module, int* phase)
+ * \brief Return in \a module and \a phase the gradient at the column \a col of the rows \a window, with the 3x3
+ *        kernels \a kernelX and \a kernelY, as modulePGM() and phasePGM() compute them.
+ *
+ * The three rows, the one of the pixel and the ones above and below it, are loaded by loadStripRow() with one
+ * halo pixel, so the border policy is the one of the convolutions of sobelPGM().
+ */
+void edgeGradient(int** window, double* kernelX, double* kernelY, int col, int* module, int* phase)
+{
+    int k, l;
+    double gx = 0, gy = 0;
+    
+    for (k = 0; k < 3; k++)
+        for (l = -1; l <= 1; l++) {
+            gx += window[k][col+l]*kernelX[3*k+l+1];
+            gy += window[k][col+l]*kernelY[3*k+l+1];
+        }
+    gx = floor(gx);
+    gy = floor(gy);
+    
+    *module = (int)sqrt(gx*gx + gy*gy);
+    *phase = (int)(atan2(gy, gx)*M_1_PI*127);
+}
+
+/*! \fn int writeEdgeList(Pgm* pgm, Pgm* pgmGradient, EdgeListFormat format, char* filename)
+ * \brief Write to the binary file \a filename the position of the nonzero pixels of \a pgm, and optionally the
+ *        Sobel gradient of \a pgmGradient there, instead of the whole image.
+ *
+ * The file starts with the 4 characters "EDG1" and the width, the height, the number of edge pixels and the
+ * flags (1 for EDGE_LIST_VARINT, plus 2 if the gradient is stored), all 32 bit integers with the least
+ * significant byte first. A record follows for each edge pixel in raster order:
+ *   - EDGE_LIST_RAW: the index row * width + col as a 32 bit integer, then the module of the gradient as a 16 bit
+ *     integer (saturated) and its phase in [-127, 127] as a signed byte.
+ *   - EDGE_LIST_VARINT: the distance of the index from the previous one (from -1 for the first), minus 1, as a
+ *     varint (7 bits per byte, the least significant first, the high bit set if more bytes follow), then the
+ *     module of the gradient as a varint and its phase as a signed byte.
+ *
+ * The module and the phase are the ones of sobelPGM() with the current border policy, and are only written if
+ * \a pgmGradient is not NULL.
+ * \param pgm Pointer to the PGM image structure with the edges, typically from threshold, ced or internal_contour.
+ * \param pgmGradient Pointer to the image whose gradient is stored at the edges, or NULL.
+ * \param format EDGE_LIST_RAW or EDGE_LIST_VARINT.
+ * \param filename Name of the file.
+ * \return 0 on success, -1 if pgm is NULL or the file cannot be written.
+ */
+int writeEdgeList(Pgm* pgm, Pgm* pgmGradient, EdgeListFormat format, char* filename)
+{
+    int row, col, p, k, count, module, phase, loaded;
+    int previous = -1;
+    int* window[3];
+    
+    if(!pgm)
+    {
+        fprintf(stderr, "Error! No data to write. Please Check.\n");
+        return -1;
+    }
+    
+    FILE* fp = fopen(filename, "wb");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+        return -1;
+    }
+    
+    int width = pgm->width;
+    int height = pgm->height;
+    int* pixels = (int*)malloc(width*sizeof(int));
+    Filter* filterX = sobelXFilter();
+    Filter* filterY = sobelYFilter();
+    // the rows around the edges with a halo pixel at each side
+    int* strip = (int*)malloc(3*(width+2)*sizeof(int));
+    for (k = 0; k < 3; k++)
+        window[k] = strip+k*(width+2)+1;
+    
+    for (row = 0, count = 0; row < height; row++) {
+        getRowPGM(pgm, row, 0, width, pixels);
+        for (col = 0; col < width; col++)
+            if (pixels[col] != 0)
+                count++;
+    }
+    
+    fwrite("EDG1", 1, 4, fp);
+    writeInt32(fp, width);
+    writeInt32(fp, height);
+    writeInt32(fp, count);
+    writeInt32(fp, (format == EDGE_LIST_VARINT ? 1 : 0) | (pgmGradient ? 2 : 0));
+    
+    for (row = 0; row < height; row++) {
+        getRowPGM(pgm, row, 0, width, pixels);
+        loaded = 0;
+        for (col = 0, p = row*width; col < width; col++, p++) {
+            if (pixels[col] == 0)
+                continue;
+            if (format == EDGE_LIST_VARINT)
+                writeVarint(fp, (unsigned int)(p - previous - 1));
+            else
+                writeInt32(fp, p);
+            previous = p;
+            if (!pgmGradient)
+                continue;
+            if (!loaded) {
+                for (k = 0; k < 3; k++)
+                    loadStripRow(pgmGradient, row+k-1, 1, window[k]);
+                loaded = 1;
+            }
+            edgeGradient(window, filterX->kernel, filterY->kernel, col, &module, &phase);
+            if (format == EDGE_LIST_VARINT)
+                writeVarint(fp, (unsigned int)module);
+            else {
+                module = module > 65535 ? 65535 : module;
+                putc(module & 0xff, fp);
+                putc(module >> 8, fp);
+            }
+            putc(phase & 0xff, fp);
+        }
+    }
+    
+    free(pixels);
+    free(strip);
+    freeFilter(&filterX);
+    freeFilter(&filterY);
+    
+    // Ok close the file
+    if(fclose(fp) != 0)
+    {
+        fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+        return -1;
+    }
+    
+    printf("\nEdge list \"%s\" correctly written (%d edges).\n", filename, count);
+    
+    return 0;
+}
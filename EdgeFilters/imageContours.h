@@ -11,13 +11,76 @@
 
 #include <stdio.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "helperFunctions.h"
 #include "imageUtilities.h"
 #include "imageFilters.h"
 #include "imageBasicOps.h"
 
+/*! \def BAND_MIN_ROWS
+ *  \brief Smallest number of rows processed by each thread of hysteresisPGM() and labelPGM()
+ */
+#define BAND_MIN_ROWS 64
+
+/*! \enum EdgeListFormat
+ * \brief Encoding of the positions of the edges written by writeEdgeList().
+ */
+typedef enum
+{
+    EDGE_LIST_RAW,     /*!< Fixed size records with the linear index of each edge */
+    EDGE_LIST_VARINT   /*!< Varint coded distances between consecutive edges */
+} EdgeListFormat;
+
+/*! \struct Component
+ * \brief Area and bounding box of a connected component found by labelPGM().
+ */
+typedef struct
+{
+    int area;     /*!< Number of pixels */
+    int left;     /*!< First column */
+    int top;      /*!< First row */
+    int right;    /*!< Last column */
+    int bottom;   /*!< Last row */
+} Component;
+
+/*! \struct Contour
+ * \brief A border found by traceContoursPGM(), as Freeman chain codes from its first point.
+ */
+typedef struct
+{
+    int x;        /*!< Column of the first point */
+    int y;        /*!< Row of the first point */
+    int parent;   /*!< Index of the border that encloses this one, -1 for the image frame */
+    int hole;     /*!< 1 for the border of a hole, 0 for the outer border of a component */
+    int length;   /*!< Number of chain codes, 0 for an isolated pixel */
+    int first;    /*!< Index of the first chain code in Contours::codes */
+} Contour;
+
+/*! \struct Contours
+ * \brief The borders of the components of an image and their chain codes.
+ */
+typedef struct
+{
+    int width;                /*!< Width of the image */
+    int height;               /*!< Height of the image */
+    int count;                /*!< Number of contours */
+    int room;                 /*!< Room for contours */
+    Contour* contours;        /*!< The contours in the order they are found by a raster scan */
+    int size;                 /*!< Number of chain codes */
+    int capacity;             /*!< Room for chain codes */
+    unsigned char* codes;     /*!< Chain codes of all the contours: 0 is east and the codes turn counterclockwise */
+} Contours;
+
 int contourUniformPGM(Pgm* pgmIn, Pgm* pgmOut);
 int contourN8IntPGM(Pgm* pgmIn, Pgm* pgmOut);
 int connectivityPGM(Pgm *pgmNH, Pgm *pgmNL, Pgm *pgmOut);
+int hysteresisPGM(Pgm* pgmIn, Pgm* pgmOut, int threshold_low, int threshold_high);
+int labelPGM(Pgm* pgmIn, Pgm* pgmOut, int connectivity, Component** components);
+int writeComponents(Component* components, int count, char* filename);
+Contours* traceContoursPGM(Pgm* pgmIn);
+void freeContours(Contours** contours);
+int writeContours(Contours* contours, char* filename);
+int writeEdgeList(Pgm* pgm, Pgm* pgmGradient, EdgeListFormat format, char* filename);
 
 #endif /* imageContours_h */
@@ -0,0 +1,482 @@
+/*! \file imageFFT.c
+ *  \brief 2D FFT of real images and overlap-save convolutions computed with it.
+ *
+ *  The FFT is the iterative radix-2 one: the tiles of the overlap-save convolution have power of 2
+ *  sides chosen for the kernel, so other radices are never needed. The rows of a real tile are
+ *  transformed two at a time, as the real and imaginary parts of a complex row, and only the
+ *  width / 2 + 1 columns of the spectrum that are not redundant are kept. The columns are transformed
+ *  FFT_BLOCK at a time, copied in a contiguous buffer so that they stay in cache.
+ *  \author Gianluca Gerard
+ *  \copyright Apache License Version 2.0, January 2004
+ */
+
+#include "imageFFT.h"
+#include "imageBasicOps.h"
+#include "imageKernels.h"
+
+/*! \fn FFTPlan* newFFTPlan(int n)
+ * \brief Allocate the tables of the FFT of \a n complex values.
+ * \param n The number of values, a power of 2.
+ * \return Pointer to the plan, NULL if \a n is not a power of 2.
+ */
+FFTPlan* newFFTPlan(int n)
+{
+    int i, j, bits;
+    
+    if (n < 2 || (n & (n-1)) != 0)
+    {
+        fprintf(stderr, "Error! The FFT size %d is not a power of 2. Please Check.\n", n);
+        return NULL;
+    }
+    
+    FFTPlan* plan = (FFTPlan*)malloc(sizeof(FFTPlan));
+    plan->n = n;
+    plan->twiddles = (double*)malloc(n*sizeof(double));
+    plan->reversal = (int*)malloc(n*sizeof(int));
+    plan->work = (double*)malloc(2*n*sizeof(double));
+    
+    for (i = 0; i < n/2; i++) {
+        plan->twiddles[2*i] = cos(2*M_PI*i/n);
+        plan->twiddles[2*i+1] = -sin(2*M_PI*i/n);
+    }
+    
+    for (bits = 0; (1 << bits) < n; bits++)
+        ;
+    for (i = 0; i < n; i++) {
+        plan->reversal[i] = 0;
+        for (j = 0; j < bits; j++)
+            if (i & (1 << j))
+                plan->reversal[i] |= 1 << (bits-1-j);
+    }
+    
+    return plan;
+}
+
+/*! \fn void freeFFTPlan(FFTPlan** plan)
+ * \brief Free the tables of the FFT \a plan.
+ */
+void freeFFTPlan(FFTPlan** plan)
+{
+    if (*plan) {
+        free((*plan)->twiddles);
+        free((*plan)->reversal);
+        free((*plan)->work);
+        free(*plan);
+        *plan = NULL;
+    }
+}
+
+/*! \fn void fft1D(FFTPlan* plan, double* data, int inverse)
+ * \brief Transform in place the \a plan->n complex values \a data, stored as pairs of real and imaginary parts.
+ *
+ * The inverse transform is not scaled by 1 / n.
+ * \param plan Pointer to the tables of the FFT.
+ * \param data The complex values.
+ * \param inverse 1 for the inverse transform, 0 for the direct one.
+ */
+void fft1D(FFTPlan* plan, double* data, int inverse)
+{
+    int i, j, k, len, half, step;
+    double tr, ti, wr, wi;
+    int n = plan->n;
+    double sign = inverse ? -1 : 1;
+    double* a;
+    double* b;
+    
+    for (i = 0; i < n; i++) {
+        j = plan->reversal[i];
+        if (i < j) {
+            tr = data[2*i];
+            ti = data[2*i+1];
+            data[2*i] = data[2*j];
+            data[2*i+1] = data[2*j+1];
+            data[2*j] = tr;
+            data[2*j+1] = ti;
+        }
+    }
+    
+    // the first stage has no twiddles
+    for (i = 0; i < 2*n; i += 4) {
+        tr = data[i+2];
+        ti = data[i+3];
+        data[i+2] = data[i]-tr;
+        data[i+3] = data[i+1]-ti;
+        data[i] += tr;
+        data[i+1] += ti;
+    }
+    
+    // the twiddle is loaded once for all the butterflies that use it
+    for (len = 4; len <= n; len *= 2) {
+        half = len/2;
+        step = n/len;
+        for (k = 0; k < half; k++) {
+            wr = plan->twiddles[2*k*step];
+            wi = sign*plan->twiddles[2*k*step+1];
+            for (i = k; i < n; i += len) {
+                a = data+2*i;
+                b = a+2*half;
+                tr = b[0]*wr-b[1]*wi;
+                ti = b[0]*wi+b[1]*wr;
+                b[0] = a[0]-tr;
+                b[1] = a[1]-ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+/*! \fn void fftColumns(FFTPlan* plan, double* spectrum, int inverse)
+ * \brief Transform in place the columns of a spectrum of \a plan->n rows of \a plan->n / 2 + 1 complex values.
+ *
+ * The butterflies combine whole rows of FFT_BLOCK columns, so that the inner loops run on contiguous
+ * values and the columns of a block stay in cache through all the stages.
+ */
+void fftColumns(FFTPlan* plan, double* spectrum, int inverse)
+{
+    int i, j, k, c, c0, nc, len, half, step;
+    double tr, ti, wr, wi;
+    int n = plan->n;
+    int h = n/2+1;
+    double sign = inverse ? -1 : 1;
+    double* a;
+    double* b;
+    
+    for (c0 = 0; c0 < h; c0 += FFT_BLOCK) {
+        nc = h-c0 < FFT_BLOCK ? h-c0 : FFT_BLOCK;
+    
+        for (i = 0; i < n; i++) {
+            j = plan->reversal[i];
+            if (i < j) {
+                a = spectrum+2*(i*h+c0);
+                b = spectrum+2*(j*h+c0);
+                for (c = 0; c < 2*nc; c++) {
+                    tr = a[c];
+                    a[c] = b[c];
+                    b[c] = tr;
+                }
+            }
+        }
+    
+        for (len = 2; len <= n; len *= 2) {
+            half = len/2;
+            step = n/len;
+            for (k = 0; k < half; k++) {
+                wr = plan->twiddles[2*k*step];
+                wi = sign*plan->twiddles[2*k*step+1];
+                for (i = k; i < n; i += len) {
+                    a = spectrum+2*(i*h+c0);
+                    b = a+2*half*h;
+                    for (c = 0; c < 2*nc; c += 2) {
+                        tr = b[c]*wr-b[c+1]*wi;
+                        ti = b[c]*wi+b[c+1]*wr;
+                        b[c] = a[c]-tr;
+                        b[c+1] = a[c+1]-ti;
+                        a[c] += tr;
+                        a[c+1] += ti;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*! \fn void fftReal2D(FFTPlan* plan, double* tile, double* spectrum)
+ * \brief Compute the spectrum of the real \a plan->n x \a plan->n image \a tile.
+ * \param plan Pointer to the tables of the FFT.
+ * \param tile The real image, row by row.
+ * \param spectrum The \a plan->n rows of the first \a plan->n / 2 + 1 complex values of the spectrum,
+ *        as pairs of real and imaginary parts.
+ */
+void fftReal2D(FFTPlan* plan, double* tile, double* spectrum)
+{
+    int r, x, k;
+    double zr, zi, cr, ci;
+    int n = plan->n;
+    int h = n/2+1;
+    double* z = plan->work;
+    
+    // two rows at a time: with z = a + i b, A[k] = (Z[k] + conj(Z[n-k])) / 2 and B[k] = (Z[k] - conj(Z[n-k])) / 2i
+    for (r = 0; r < n; r += 2) {
+        double* a = tile+r*n;
+        double* b = a+n;
+        double* specA = spectrum+2*r*h;
+        double* specB = specA+2*h;
+        for (x = 0; x < n; x++) {
+            z[2*x] = a[x];
+            z[2*x+1] = b[x];
+        }
+        fft1D(plan, z, 0);
+        for (k = 0; k < h; k++) {
+            zr = z[2*k];
+            zi = z[2*k+1];
+            cr = z[2*((n-k)%n)];
+            ci = -z[2*((n-k)%n)+1];
+            specA[2*k] = (zr+cr)/2;
+            specA[2*k+1] = (zi+ci)/2;
+            specB[2*k] = (zi-ci)/2;
+            specB[2*k+1] = (cr-zr)/2;
+        }
+    }
+    
+    fftColumns(plan, spectrum, 0);
+}
+
+/*! \fn void fftInverseReal2D(FFTPlan* plan, double* spectrum, double* tile)
+ * \brief Compute the real \a plan->n x \a plan->n image \a tile of the spectrum \a spectrum, that is overwritten.
+ *
+ * The inverse of fftReal2D(), scaled by 1 / n^2.
+ * \param plan Pointer to the tables of the FFT.
+ * \param spectrum The spectrum, in the layout of fftReal2D().
+ * \param tile The real image, row by row.
+ */
+void fftInverseReal2D(FFTPlan* plan, double* spectrum, double* tile)
+{
+    int r, x, k;
+    double ar, ai, br, bi;
+    int n = plan->n;
+    int h = n/2+1;
+    double scale = 1.0/((double)n*n);
+    double* z = plan->work;
+    
+    fftColumns(plan, spectrum, 1);
+    
+    // two rows at a time: the rows are real, so Z = A + i B has the real row a and the imaginary one b
+    for (r = 0; r < n; r += 2) {
+        double* specA = spectrum+2*r*h;
+        double* specB = specA+2*h;
+        for (k = 0; k < n; k++) {
+            if (k < h) {
+                ar = specA[2*k];
+                ai = specA[2*k+1];
+                br = specB[2*k];
+                bi = specB[2*k+1];
+            } else {
+                ar = specA[2*(n-k)];
+                ai = -specA[2*(n-k)+1];
+                br = specB[2*(n-k)];
+                bi = -specB[2*(n-k)+1];
+            }
+            z[2*k] = ar-bi;
+            z[2*k+1] = ai+br;
+        }
+        fft1D(plan, z, 1);
+        for (x = 0; x < n; x++) {
+            tile[r*n+x] = z[2*x]*scale;
+            tile[(r+1)*n+x] = z[2*x+1]*scale;
+        }
+    }
+}
+
+/*! \fn int fftTileSize(int width, int height, int dimX, int dimY)
+ * \brief Return the side of the tiles of the overlap-save convolution of a \a width x \a height image with a \a dimX x \a dimY kernel.
+ *
+ * Each tile gives (side - dimX + 1) x (side - dimY + 1) output pixels for about side^2 log2(side)
+ * operations: the side is the power of 2 up to FFT_MAX_TILE with the lowest cost for the whole image.
+ * \return The side of the tiles, 0 if the kernel is too large for them.
+ */
+int fftTileSize(int width, int height, int dimX, int dimY)
+{
+    int n, bits;
+    int best = 0;
+    double cost, bestCost = 0;
+    
+    for (n = 4, bits = 2; n <= FFT_MAX_TILE; n *= 2, bits++) {
+        if (n <= dimX || n <= dimY)
+            continue;
+        cost = (double)((width+n-dimX)/(n-dimX+1))*((height+n-dimY)/(n-dimY+1))*n*n*bits;
+        if (best == 0 || cost < bestCost) {
+            best = n;
+            bestCost = cost;
+        }
+    }
+    
+    return best;
+}
+
+/*! \fn int fftConvolveTiles(Pgm* pgmIn, Pgm* pgmOut, Filter* filter, int n)
+ * \brief Convolve \a pgmIn with \a filter by overlap-save on tiles of \a n x \a n pixels and store the result in \a pgmOut.
+ *
+ * Each tile of the input, extended by the border policy, is multiplied in the frequency domain by the
+ * conjugate spectrum of the kernel, which correlates it with the kernel as convolution2DPGM() does.
+ * Of the inverse transform only the pixels that do not wrap around the tile are kept, so consecutive
+ * tiles overlap by the kernel size minus one. The results are rounded down after adding 1e-6, which
+ * absorbs the rounding errors of the FFT on the exact integer results of integer kernels.
+ * \a pgmOut must already have its format and must not be \a pgmIn.
+ * \return The largest value of the result.
+ */
+int fftConvolveTiles(Pgm* pgmIn, Pgm* pgmOut, Filter* filter, int n)
+{
+    int i, j, r, x, x0, y0, rows, cols;
+    double tr, ti, kr, ki;
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    int dimX = filter->width;
+    int dimY = filter->height;
+    int spanX = dimX/2;
+    int spanY = dimY/2;
+    int stepX = n-dimX+1;
+    int stepY = n-dimY+1;
+    int h = n/2+1;
+    int max_val = 0;
+    
+    FFTPlan* plan = newFFTPlan(n);
+    double* tile = (double*)calloc((size_t)n*n, sizeof(double));
+    double* spectrum = (double*)malloc((size_t)2*n*h*sizeof(double));
+    double* kernelSpectrum = (double*)malloc((size_t)2*n*h*sizeof(double));
+    
+    for (r = 0; r < dimY; r++)
+        for (x = 0; x < dimX; x++)
+            tile[r*n+x] = filter->kernel[r*dimX+x];
+    fftReal2D(plan, tile, kernelSpectrum);
+    
+    // n rows of the input from the border policy, with room on the right for the last tile
+    int stripWidth = width+2*spanX+n;
+    int* strip = (int*)calloc((size_t)n*stripWidth, sizeof(int));
+    int* outRows = (int*)malloc((size_t)stepY*width*sizeof(int));
+    
+    for (y0 = 0; y0 < height; y0 += stepY) {
+        rows = height-y0 < stepY ? height-y0 : stepY;
+        for (r = 0; r < n; r++)
+            loadStripRow(pgmIn, y0-spanY+r, spanX, strip+(size_t)r*stripWidth+spanX);
+    
+        for (x0 = 0; x0 < width; x0 += stepX) {
+            cols = width-x0 < stepX ? width-x0 : stepX;
+            for (r = 0; r < n; r++)
+                for (x = 0; x < n; x++)
+                    tile[r*n+x] = strip[(size_t)r*stripWidth+x0+x];
+            fftReal2D(plan, tile, spectrum);
+            for (i = 0; i < n*h; i++) {
+                tr = spectrum[2*i];
+                ti = spectrum[2*i+1];
+                kr = kernelSpectrum[2*i];
+                ki = kernelSpectrum[2*i+1];
+                spectrum[2*i] = tr*kr+ti*ki;
+                spectrum[2*i+1] = ti*kr-tr*ki;
+            }
+            fftInverseReal2D(plan, spectrum, tile);
+            for (i = 0; i < rows; i++)
+                for (j = 0; j < cols; j++)
+                    outRows[i*width+x0+j] = (int)floor(tile[i*n+j]+1e-6);
+        }
+    
+        for (i = 0; i < rows; i++) {
+            for (j = 0; j < width; j++)
+                if (outRows[i*width+j] > max_val)
+                    max_val = outRows[i*width+j];
+            setRowPGM(pgmOut, y0+i, 0, width, outRows+i*width);
+        }
+    }
+    
+    freeFFTPlan(&plan);
+    free(tile);
+    free(spectrum);
+    free(kernelSpectrum);
+    free(strip);
+    free(outRows);
+    
+    return max_val;
+}
+
+// The smallest kernel dimension convolved with the FFT, 0 until it is read
+int fftCrossover = 0;
+
+/*! \fn int fftCrossoverPGM(void)
+ * \brief Return the smallest kernel dimension for which the FFT convolution replaces the direct one.
+ *
+ * The first call reads it from the FFT_ENV environment variable or, if it is not set, takes FFT_CROSSOVER.
+ * The crossover is not measured at run time, so that the choice between the two convolutions, and with
+ * it the rounding of the results, does not change from one run to the next.
+ * \return The crossover dimension.
+ */
+int fftCrossoverPGM(void)
+{
+    char* env = getenv(FFT_ENV);
+    
+    if (fftCrossover > 0)
+        return fftCrossover;
+    
+    if (env != NULL && atoi(env) > 0)
+        fftCrossover = atoi(env);
+    else
+        fftCrossover = FFT_CROSSOVER;
+    
+    return fftCrossover;
+}
+
+/*! \fn int fftConvolutionPays(Filter* filter)
+ * \brief Return 1 if the convolution with \a filter is faster with the FFT.
+ *
+ * Only 2D kernels with odd dimensions, the larger one at least FFT_MIN_DIM and fftCrossoverPGM(), qualify.
+ */
+int fftConvolutionPays(Filter* filter)
+{
+    int dim = filter->width > filter->height ? filter->width : filter->height;
+    
+    if (filter->width < 2 || filter->height < 2 || filter->width%2 == 0 || filter->height%2 == 0)
+        return 0;
+    
+    if (dim < FFT_MIN_DIM || fftTileSize(1, 1, filter->width, filter->height) == 0)
+        return 0;
+    
+    return dim >= fftCrossoverPGM();
+}
+
+/*! \fn int fftConvolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+ * \brief Apply to the image \a pgmIn a 2D convolution with the Filter \a filter computed with the FFT.
+ *
+ * The result is the same of convolution2DPGM() up to the rounding (see fftConvolveTiles()), the cost per
+ * pixel grows with the logarithm of the kernel size instead of with its area.
+ * \param pgmIn Pointer to the input Pgm image structure.
+ * \param pgmOut Pointer to the output Pgm image structure.
+ * \param filter Pointer to the Filter structure, with odd dimensions.
+ * \return 0 on success, -1 if either pgmIn, pgmOut or filter are NULL or the kernel is too large.
+ */
+int fftConvolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter)
+{
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    if(!filter)
+    {
+        fprintf(stderr, "Error! No filter defined. Please Check.\n");
+        return -1;
+    }
+    
+    int n = fftTileSize(pgmIn->width, pgmIn->height, filter->width, filter->height);
+    if (n == 0)
+    {
+        fprintf(stderr, "Error! The kernel is too large for the FFT convolution. Please Check.\n");
+        return -1;
+    }
+    
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    PgmFormat format = kernelFormatPGM(pgmIn, filter->kernel, filter->width, filter->height);
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(pgmIn->width, pgmIn->height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    int max_val = fftConvolveTiles(pgmIn, out, filter, n);
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*! \file imageFFT.h
+ *  \brief Interfaces to the 2D FFT and to the convolutions computed with it.
+ *  \author Gianluca Gerard
+ *  \copyright Apache License Version 2.0, January 2004
+ */
+
+#ifndef imageFFT_h
+#define imageFFT_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "imageUtilities.h"
+#include "imageFilters.h"
+
+/*! \def FFT_ENV
+ * \brief Environment variable with the smallest kernel dimension convolved with the FFT (FFT_CROSSOVER if not set).
+ */
+#define FFT_ENV "FILTERPGM_FFT"
+
+/*! \def FFT_CROSSOVER
+ * \brief Default smallest kernel dimension convolved with the FFT, where it gets faster than the direct convolution
+ */
+#define FFT_CROSSOVER 33
+
+/*! \def FFT_MIN_DIM
+ * \brief Smallest kernel dimension for which the FFT convolution is considered
+ */
+#define FFT_MIN_DIM 7
+
+/*! \def FFT_MAX_TILE
+ * \brief Largest side of the tiles of the overlap-save convolution
+ */
+#define FFT_MAX_TILE 512
+
+/*! \def FFT_BLOCK
+ * \brief Number of columns transformed together by the column passes of the 2D FFT
+ */
+#define FFT_BLOCK 8
+
+/*! \struct FFTPlan
+ * \brief Tables of the radix-2 FFT of \a n complex values.
+ */
+typedef struct
+{
+    int n;              /*!< Number of complex values, a power of 2 */
+    double* twiddles;   /*!< exp(-2 pi i k / n) for k < n / 2, as pairs of real and imaginary parts */
+    int* reversal;      /*!< Bit reversal permutation of the indices */
+    double* work;       /*!< Room for n complex values */
+} FFTPlan;
+
+FFTPlan* newFFTPlan(int n);
+void freeFFTPlan(FFTPlan** plan);
+void fft1D(FFTPlan* plan, double* data, int inverse);
+void fftReal2D(FFTPlan* plan, double* tile, double* spectrum);
+void fftInverseReal2D(FFTPlan* plan, double* spectrum, double* tile);
+
+int fftTileSize(int width, int height, int dimX, int dimY);
+int fftCrossoverPGM(void);
+int fftConvolutionPays(Filter* filter);
+int fftConvolution2DPGM(Pgm* pgmIn, Pgm* pgmOut, Filter* filter);
+
+#endif /* imageFFT_h */
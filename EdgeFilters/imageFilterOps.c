@@ -76,9 +76,6 @@ const static int* nagao[] = {
     n0, n1, n2, n3, n4, n5, n6, n7, n8
 };
 
-// Number of 1's in each Nagao matrix
-const static int nagaoSize[9] = {9, 7, 7, 7, 7, 7, 7, 7, 7};
-
 /*! \fn Filter *linearAddFilter(Filter* filterOp1, Filter* filterOp2, double w1, double w2)
  * \brief Linear weighted sum of two Filters.
  *
@@ -122,7 +119,7 @@ Filter *linearAddFilter(Filter* filterOp1, Filter* filterOp2, double w1, double
  */
 int addUniformNoisePGM(Pgm* pgmIn, Pgm* pgmOut, int range)
 {
-    int i;
+    int i, j;
     int randVal;
     
     if(!pgmIn)
@@ -137,32 +134,48 @@ int addUniformNoisePGM(Pgm* pgmIn, Pgm* pgmOut, int range)
         return -1;
     }
     
-    // Limit the noise range between 0 and 127
+    // Limit the noise range between 0 and half the dynamic
+    // range of the image (127 for 8 bits images)
+    int max_range = (pgmIn->max_val+1)/2-1;
     if (range < 0) {
         range = -range;
     }
-    if (range > 127) {
-        range = 127;
+    if (range > max_range) {
+        range = max_range;
     }
     
     int width = pgmIn->width;
     int height = pgmIn->height;
     
+    // The noise can move pixels outside the input range
+    double lo, hi;
+    rangeFormatPGM(pgmIn->format, &lo, &hi);
+    Pgm* out = targetPGM(pgmOut, fitFormatPGM(lo-range, hi+range), pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        randVal = random()%(2*range)-range;
-        pgmOut->pixels[i] = pgmIn->pixels[i] + randVal;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for (j = 0; j < width; j++) {
+            randVal = random()%(2*range)-range;
+            pixels[j] += randVal;
+        }
+        setRowPGM(out, i, 0, width, pixels);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = pgmIn->max_val+range;
     
+    free(pixels);
+    
     return 0;
 }
 
 /*! \fn int addSaltPepperNoisePGM(Pgm* pgmIn, Pgm* pgmOut, double density)
  * \brief Add Salt & Pepper noise to the image \a pgmIn. The final result is stored in \a pgmOut.
  *
- * Superimpose a percentage 'density' of white or black pixels onto the image.
+ * Superimpose a percentage 'density' of white or black pixels onto the image. White pixels
+ * have the maximum value of \a pgmIn.
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
  * \param density The percentage of pixels that will become black or white with equal probability.
@@ -170,7 +183,7 @@ int addUniformNoisePGM(Pgm* pgmIn, Pgm* pgmOut, int range)
  */
 int addSaltPepperNoisePGM(Pgm* pgmIn, Pgm* pgmOut, double density)
 {
-    int i;
+    int i, j;
     
     if(!pgmIn)
     {
@@ -186,110 +199,842 @@ int addSaltPepperNoisePGM(Pgm* pgmIn, Pgm* pgmOut, double density)
     
     int width = pgmIn->width;
     int height = pgmIn->height;
+    int white = pgmIn->max_val;
+    
+    double lo, hi;
+    rangeFormatPGM(pgmIn->format, &lo, &hi);
+    Pgm* out = targetPGM(pgmOut, fitFormatPGM(fmin(lo, 0), fmax(hi, white)), pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
     
     // Iterate over all pixels
-    for (i = 0; i < width*height; i++) {
-        if (drandom()>density) {
-            pgmOut->pixels[i] = pgmIn->pixels[i];
-        } else {
-            // A density percentage of pixels will randomly
-            // be transformed to black or white
-            if (random()&01) {
-                pgmOut->pixels[i] = 0;
-            } else {
-                pgmOut->pixels[i] = 255;
+    for (i = 0; i < height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for (j = 0; j < width; j++) {
+            if (drandom()<=density) {
+                // A density percentage of pixels will randomly
+                // be transformed to black or white
+                if (random()&01) {
+                    pixels[j] = 0;
+                } else {
+                    pixels[j] = white;
+                }
             }
         }
+        setRowPGM(out, i, 0, width, pixels);
     }
     
-    pgmOut->max_val = 255;
+    storePGM(out, pgmOut);
+    pgmOut->max_val = white;
+    
+    free(pixels);
     
     return 0;
 }
 
-/*! \fn medianKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
- * \brief Return the median pixel of an image subarray of dimensions (dimX, dimY).
+/*! \fn int compareInt(const void* a, const void* b)
+ * \brief Compare two integers for qsort() and bsearch().
+ */
+int compareInt(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    
+    return (x > y) - (x < y);
+}
+
+/*! \fn int compareDouble(const void* a, const void* b)
+ * \brief Compare two doubles for qsort().
+ */
+int compareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    
+    return (x > y) - (x < y);
+}
+
+/*! \struct MedianHistogram
+ * \brief Histogram of the levels of the pixels in the window of medianPGM().
  *
- * \param pgmIn1 Pointer to the Pgm structure of the input image.
- * \param pgmIn2 Not used.
- * \param kernel Not used.
- * \param spanX The number of columns to the left and right of the central column of the image subarray.
- * \param spanY The number of rows to the top and to the bottom of the central row of the image subarray.
- * \param ic The linear index of the central subarray pixel in \a pgmIn1.
- * \return The value of the median pixel.
+ * The fine histogram counts the pixels of each level, the coarse one the pixels in each group of
+ * MEDIAN_BUCKET consecutive levels, so that the median can skip whole groups of empty levels.
  */
-int medianKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
+typedef struct
 {
-    int k, l, il;
-    int* pixels;
-    int pixel;
-    int ix = 0;
-    int width = pgmIn1->width;
+    int* fine;    /*!< Number of pixels for each level */
+    int* coarse;  /*!< Number of pixels for each group of MEDIAN_BUCKET levels */
+    int median;   /*!< The level of the median */
+    int below;    /*!< Number of pixels with a level lower than median */
+} MedianHistogram;
+
+/*! \fn void medianUpdate(MedianHistogram* h, int* levels, int first, int last, int delta)
+ * \brief Add \a delta to the counts in the histogram \a h of the levels from \a levels[first] to \a levels[last].
+ */
+void medianUpdate(MedianHistogram* h, int* levels, int first, int last, int delta)
+{
+    int i, level;
+    
+    for (i = first; i <= last; i++) {
+        level = levels[i];
+        h->fine[level] += delta;
+        h->coarse[level/MEDIAN_BUCKET] += delta;
+        if (level < h->median)
+            h->below += delta;
+    }
+}
+
+/*! \fn void medianSlide(MedianHistogram* h, int* levels, int out, int in)
+ * \brief Remove from the histogram \a h the level \a levels[out] and add the level \a levels[in].
+ */
+void medianSlide(MedianHistogram* h, int* levels, int out, int in)
+{
+    int leaving = levels[out];
+    int entering = levels[in];
     
-    pixels = calloc((2*spanX+1)*(2*spanY+1), sizeof(int));
+    if (leaving == entering)
+        return;
     
-    // Iterate over all filter pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
-        for (l=-spanX; l <= spanX; l++)
-            pixels[ix++] = pgmIn1->pixels[il+l];
+    h->fine[leaving]--;
+    h->coarse[leaving/MEDIAN_BUCKET]--;
+    h->fine[entering]++;
+    h->coarse[entering/MEDIAN_BUCKET]++;
+    h->below += (entering < h->median) - (leaving < h->median);
+}
+
+/*! \fn int medianLevel(MedianHistogram* h, int rank)
+ * \brief Move the median of the histogram \a h to the level of the pixel of rank \a rank and return it.
+ *
+ * The median only moves by the difference with the previous window, skipping the empty groups of levels.
+ */
+int medianLevel(MedianHistogram* h, int rank)
+{
+    int m = h->median;
+    
+    // too many pixels below the median: move down
+    while (h->below > rank) {
+        if (m % MEDIAN_BUCKET == 0 && h->below - h->coarse[m/MEDIAN_BUCKET-1] > rank) {
+            m -= MEDIAN_BUCKET;
+            h->below -= h->coarse[m/MEDIAN_BUCKET];
+        } else {
+            m--;
+            h->below -= h->fine[m];
+        }
+    }
+    
+    // not enough pixels up to the median: move up
+    while (h->below + h->fine[m] <= rank) {
+        if (m % MEDIAN_BUCKET == 0 && h->below + h->coarse[m/MEDIAN_BUCKET] <= rank) {
+            h->below += h->coarse[m/MEDIAN_BUCKET];
+            m += MEDIAN_BUCKET;
+        } else {
+            h->below += h->fine[m];
+            m++;
+        }
+    }
+    
+    h->median = m;
+    return m;
+}
+
+/*! \fn int* medianRow(int* ring, int y, int radius, int rowLen)
+ * \brief Return the pointer to the first image pixel of the row \a y in the ring of 2 \a radius + 2 rows of medianPGM().
+ */
+int* medianRow(int* ring, int y, int radius, int rowLen)
+{
+    return ring + (size_t)((y+radius) % (2*radius+2))*rowLen + radius;
+}
+
+/*! \fn void loadLevelsRow(Pgm* pgm, int row, int radius, int lo, int* values, int nLevels, int* dst)
+ * \brief Copy in \a dst the levels of the pixels of the row \a row of \a pgm, with \a radius halo pixels on each side.
+ * \param pgm Pointer to the Pgm image structure.
+ * \param row The index of the row, possibly outside the image.
+ * \param radius The number of halo pixels on the left and on the right of the row.
+ * \param lo The value of level 0 if \a values is NULL.
+ * \param values The sorted array of the value of each level, or NULL if the level is the value minus \a lo.
+ * \param nLevels The number of levels.
+ * \param dst Pointer to the position of the first image pixel in the row.
+ */
+void loadLevelsRow(Pgm* pgm, int row, int radius, int lo, int* values, int nLevels, int* dst)
+{
+    int k;
+    
+    loadStripRow(pgm, row, radius, dst);
+    for (k = -radius; k < pgm->width+radius; k++)
+        if (values)
+            dst[k] = (int)((int*)bsearch(dst+k, values, nLevels, sizeof(int), compareInt) - values);
+        else
+            dst[k] -= lo;
+}
+
+/*! \fn int medianHistogramRows(Pgm* pgmIn, Pgm* out, int radius)
+ * \brief Store in \a out the median of each (2 \a radius + 1)x(2 \a radius + 1) window of \a pgmIn.
+ *
+ * The window slides along the rows in alternate directions and moves down one row at their ends.
+ * At each step the pixels leaving and entering the window are removed from and added to a histogram
+ * of the pixels levels, and the median is moved from its previous position. The cost per pixel
+ * grows with \a radius and not with the area of the window. The levels are the pixel values minus
+ * the minimum value or, if the values span more than MEDIAN_LEVELS levels, the ranks of the values.
+ * \return The maximum value of the medians.
+ */
+int medianHistogramRows(Pgm* pgmIn, Pgm* out, int radius)
+{
+    int i, j, k, y;
+    int lo, hi;
+    int nLevels;
+    int* values = NULL; // the value of each level if the levels are ranks
+    int max_val = 0;
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    int side = 2*radius+1;
+    int rowLen = width+2*radius;
+    
+    // The rows from i-radius to i+radius+1 with radius halo pixels on each side
+    int* ring = (int*)malloc((size_t)(side+1)*rowLen*sizeof(int));
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    
+    haloRangePGM(pgmIn, radius > 0, &lo, &hi);
+    if ((double)hi - lo < MEDIAN_LEVELS) {
+        nLevels = hi-lo+1;
+    } else {
+        // sort the image values, together with the border value, and keep the distinct ones
+        size_t n = (size_t)width*height;
+        values = (int*)malloc((n+2)*sizeof(int));
+        for (i = 0; i < height; i++)
+            getRowPGM(pgmIn, i, 0, width, values+(size_t)i*width);
+        values[n] = lo;
+        values[n+1] = hi;
+        qsort(values, n+2, sizeof(int), compareInt);
+        for (i = 1, nLevels = 1; i < n+2; i++)
+            if (values[i] != values[nLevels-1])
+                values[nLevels++] = values[i];
+    }
+    
+    MedianHistogram h;
+    h.fine = (int*)calloc((nLevels/MEDIAN_BUCKET+1)*MEDIAN_BUCKET, sizeof(int));
+    h.coarse = (int*)calloc(nLevels/MEDIAN_BUCKET+1, sizeof(int));
+    h.median = 0;
+    h.below = 0;
     
-    int nPixels = ix;
+    for (y = -radius; y <= radius; y++) {
+        loadLevelsRow(pgmIn, y, radius, lo, values, nLevels, medianRow(ring, y, radius, rowLen));
+        medianUpdate(&h, medianRow(ring, y, radius, rowLen), -radius, radius, 1);
+    }
     
-    // Sort the pixels
-    pixels = sort(pixels, nPixels);
+    int rank = side*side/2;
+    int col = 0;
+    int dir = 1;
+    for (i = 0; i < height; i++) {
+        for (j = 0; j < width; j++) {
+            if (j > 0) {
+                // slide the window by one column
+                col += dir;
+                for (y = i-radius; y <= i+radius; y++)
+                    medianSlide(&h, medianRow(ring, y, radius, rowLen), col-dir*(radius+1), col+dir*radius);
+            }
+            k = medianLevel(&h, rank);
+            outPixels[col] = values ? values[k] : k+lo;
+            if (outPixels[col] > max_val)
+                max_val = outPixels[col];
+        }
+        setRowPGM(out, i, 0, width, outPixels);
+        
+        if (i+1 < height) {
+            // move the window down by one row and reverse the direction
+            y = i+radius+1;
+            loadLevelsRow(pgmIn, y, radius, lo, values, nLevels, medianRow(ring, y, radius, rowLen));
+            medianUpdate(&h, medianRow(ring, i-radius, radius, rowLen), col-radius, col+radius, -1);
+            medianUpdate(&h, medianRow(ring, y, radius, rowLen), col-radius, col+radius, 1);
+            dir = -dir;
+        }
+    }
     
-    // Store the pixel in the middle of the sorted list
-    pixel = pixels[nPixels/2];
+    free(h.fine);
+    free(h.coarse);
+    free(values);
+    free(ring);
+    free(outPixels);
     
-    free(pixels);
+    return max_val;
+}
+
+// Sorting network of 3 values
+const static int medianSort3[][2] = {{0,1}, {1,2}, {0,1}};
+
+// Sorting network of 5 values
+const static int medianSort5[][2] = {{0,1}, {3,4}, {2,4}, {2,3}, {1,4}, {0,3}, {0,2}, {1,3}, {1,2}};
+
+// Row and column of the candidates to the median of a 5x5 matrix sorted along the rows and the columns.
+// The other six elements of the upper left and lower right corners are below and above the median.
+const static int medianCandidates5[][2] = {
+    {0,3}, {0,4}, {1,2}, {1,3}, {1,4}, {2,1}, {2,2}, {2,3}, {3,0}, {3,1}, {3,2}, {4,0}, {4,1}
+};
+
+/*! \fn void medianSortRows(const KernelSet* kernels, int** rows, const int network[][2], int nPairs, int len)
+ * \brief Sort independently each column of the rows \a rows with a sorting network.
+ * \param kernels The kernel set in use.
+ * \param rows The rows to sort.
+ * \param network The pairs of rows compared and exchanged by the sorting network.
+ * \param nPairs The number of pairs in \a network.
+ * \param len The number of columns.
+ */
+void medianSortRows(const KernelSet* kernels, int** rows, const int network[][2], int nPairs, int len)
+{
+    int k;
+    
+    for (k = 0; k < nPairs; k++)
+        kernels->compareRow(rows[network[k][0]], rows[network[k][1]], len);
+}
+
+/*! \fn int* medianForget(const KernelSet* kernels, int** rows, int n, int len)
+ * \brief Return the row with the median of each column of the \a n rows \a rows, \a n odd.
+ *
+ * Forgetful selection: the minimum and the maximum of the first n/2+2 rows cannot be the median,
+ * so they are moved to the ends of the group and forgotten, and the next row joins the group,
+ * until all the rows are used and only the median is left. The rows are reordered in place.
+ */
+int* medianForget(const KernelSet* kernels, int** rows, int n, int len)
+{
+    int k;
+    int first = 0;
+    int last = n/2+1;
+    int next = last+1;
+    
+    for (;;) {
+        for (k = first+1; k <= last; k++)
+            kernels->compareRow(rows[first], rows[k], len);
+        for (k = first+1; k < last; k++)
+            kernels->compareRow(rows[k], rows[last], len);
+        first++;
+        if (next == n)
+            break;
+        rows[last] = rows[next++];
+    }
+    
+    return rows[first];
+}
+
+/*! \fn void median3Block(const KernelSet* kernels, int** cols, int n, int** work, int* out)
+ * \brief Compute the 3x3 medians of a block of \a n adjacent pixels.
+ *
+ * With the columns of the window sorted, the median is the median of the maximum of the three
+ * lowest values, the median of the three middle values and the minimum of the three highest values.
+ * \param kernels The kernel set in use.
+ * \param cols The three rows of the block with the columns sorted, from the halo pixel on the left.
+ * \param n The number of pixels in the block.
+ * \param work Three rows of at least \a n pixels.
+ * \param out Pointer to the row where the medians are stored.
+ */
+void median3Block(const KernelSet* kernels, int** cols, int n, int** work, int* out)
+{
+    int* low = cols[0]+1;
+    int* mid = cols[1]+1;
+    int* high = cols[2]+1;
+    
+    // maximum of the lowest values
+    kernels->maxRow(work[0], low-1, low, n);
+    kernels->maxRow(work[0], work[0], low+1, n);
+    // median of the middle values
+    kernels->minRow(work[1], mid-1, mid, n);
+    kernels->maxRow(work[2], mid-1, mid, n);
+    kernels->minRow(work[2], work[2], mid+1, n);
+    kernels->maxRow(work[1], work[1], work[2], n);
+    // minimum of the highest values
+    kernels->minRow(work[2], high-1, high, n);
+    kernels->minRow(work[2], work[2], high+1, n);
+    // median of the three
+    kernels->compareRow(work[0], work[1], n);
+    kernels->minRow(work[1], work[1], work[2], n);
+    kernels->maxRow(out, work[0], work[1], n);
+}
+
+/*! \fn void median5Block(const KernelSet* kernels, int** cols, int n, int** work, int* out)
+ * \brief Compute the 5x5 medians of a block of \a n adjacent pixels.
+ *
+ * The values of the same rank in the five sorted columns of each window are sorted, and the median
+ * is selected among the 13 values of the matrix that can still be the median (medianCandidates5).
+ * \param kernels The kernel set in use.
+ * \param cols The five rows of the block with the columns sorted, from the two halo pixels on the left.
+ * \param n The number of pixels in the block.
+ * \param work 25 rows of at least \a n pixels.
+ * \param out Pointer to the row where the medians are stored.
+ */
+void median5Block(const KernelSet* kernels, int** cols, int n, int** work, int* out)
+{
+    int k, d;
+    int* candidates[13];
+    
+    for (k = 0; k < 5; k++) {
+        for (d = 0; d < 5; d++)
+            memcpy(work[5*k+d], cols[k]+d, n*sizeof(int));
+        medianSortRows(kernels, work+5*k, medianSort5, 9, n);
+    }
+    
+    for (k = 0; k < 13; k++)
+        candidates[k] = work[5*medianCandidates5[k][0]+medianCandidates5[k][1]];
+    memcpy(out, medianForget(kernels, candidates, 13, n), n*sizeof(int));
+}
+
+/*! \fn int medianNetworkRows(Pgm* pgmIn, Pgm* out, int radius)
+ * \brief Store in \a out the median of each 3x3 (\a radius 1) or 5x5 (\a radius 2) window of \a pgmIn.
+ *
+ * The rows are split in blocks of MEDIAN_BLOCK pixels. The columns of a block are sorted once with a
+ * sorting network and shared by all the windows that overlap them, then the medians of all the pixels
+ * of the block are computed together with the minimum and maximum row kernels, without branches.
+ * \return The maximum value of the medians.
+ */
+int medianNetworkRows(Pgm* pgmIn, Pgm* out, int radius)
+{
+    int i, j, k, y, n;
+    int min = INT_MAX;
+    int max_val = 0;
+    int width = pgmIn->width;
+    int side = 2*radius+1;
+    int rowLen = width+2*radius;
+    int blockLen = MEDIAN_BLOCK+2*radius;
+    int nWork = side*side;
+    int* cols[5];
+    int* work[25];
+    const KernelSet* kernels = kernelsPGM();
+    
+    // The rows from i-radius to i+radius with radius halo pixels on each side
+    int* ring = (int*)malloc((size_t)side*rowLen*sizeof(int));
+    int* block = (int*)malloc((size_t)side*blockLen*sizeof(int));
+    int* workRows = (int*)malloc((size_t)nWork*MEDIAN_BLOCK*sizeof(int));
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    
+    for (k = 0; k < nWork; k++)
+        work[k] = workRows+(size_t)k*MEDIAN_BLOCK;
+    
+    for (y = -radius; y < radius; y++)
+        loadStripRow(pgmIn, y, radius, ring+(size_t)(y+radius)*rowLen+radius);
+    
+    for (i = 0; i < pgmIn->height; i++) {
+        y = i+radius;
+        loadStripRow(pgmIn, y, radius, ring+(size_t)((y+radius)%side)*rowLen+radius);
+    
+        for (j = 0; j < width; j += MEDIAN_BLOCK) {
+            n = width-j < MEDIAN_BLOCK ? width-j : MEDIAN_BLOCK;
+            for (k = 0; k < side; k++) {
+                // copy the block of the row i-radius+k, halo included, and sort its columns
+                cols[k] = block+(size_t)k*blockLen;
+                memcpy(cols[k], ring+(size_t)((i+k)%side)*rowLen+j, (n+2*radius)*sizeof(int));
+            }
+    
+            if (radius == 1) {
+                medianSortRows(kernels, cols, medianSort3, 3, n+2);
+                median3Block(kernels, cols, n, work, outPixels+j);
+            } else {
+                medianSortRows(kernels, cols, medianSort5, 9, n+4);
+                median5Block(kernels, cols, n, work, outPixels+j);
+            }
+        }
+    
+        kernels->rangeRow(outPixels, width, &min, &max_val);
+        setRowPGM(out, i, 0, width, outPixels);
+    }
+    
+    free(ring);
+    free(block);
+    free(workRows);
+    free(outPixels);
     
-    return pixel;
+    return max_val;
 }
 
-/*! \fn int medianPGM(Pgm* pgmIn, Pgm* pgmOut)
+/*! \fn int medianPGM(Pgm* pgmIn, Pgm* pgmOut, int radius)
  * \brief Apply a median filter to the image \a pgmIn. The final result is stored in \a pgmOut.
  *
- * For each pixel of \a pgmIn compute the median of a 3x3 subarray centered at the pixel.
+ * For each pixel of \a pgmIn compute the median of a (2 \a radius + 1)x(2 \a radius + 1) subarray
+ * centered at the pixel. The pixels outside the image are computed according to the border policy.
+ *
+ * The 3x3 and 5x5 medians are computed by sorting networks on blocks of adjacent pixels
+ * (see medianNetworkRows()), the larger ones with a sliding histogram (see medianHistogramRows()).
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
- * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ * \param radius The radius of the window.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the radius is negative.
  */
-int medianPGM(Pgm *pgmIn, Pgm* pgmOut)
+int medianPGM(Pgm *pgmIn, Pgm* pgmOut, int radius)
 {
-    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 3, 3, medianKernel);
+    int max_val;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    if(radius < 0)
+    {
+        fprintf(stderr, "Error! Negative median radius. Please Check.\n");
+        return -1;
+    }
+    
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(pgmIn->width, pgmIn->height, pgmOut->max_val, pgmIn->format) : pgmOut;
+    reformatPGM(out, pgmIn->format);
+    
+    if (radius == 1 || radius == 2)
+        max_val = medianNetworkRows(pgmIn, out, radius);
+    else
+        max_val = medianHistogramRows(pgmIn, out, radius);
+    
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return 0;
 }
 
+/*! \fn long long floorDiv(long long a, long long b)
+ * \brief Return \a a divided by the positive \a b, rounded down.
+ */
+long long floorDiv(long long a, long long b)
+{
+    long long q = a/b;
+    
+    return (a%b != 0 && a < 0) ? q-1 : q;
+}
 
-/*! \fn int averagePGM(Pgm* pgmIn, Pgm* pgmOut)
- * \brief Apply a box filter to the image \a pgmIn. The final result is stored in \a pgmOut.
+/*! \fn int boxPGM(Pgm* pgmIn, Pgm* pgmOut, int width, int height, int gain, int weight)
+ * \brief Combine each pixel of \a pgmIn with the mean of the \a width x \a height box around it.
+ *
+ * Store in \a pgmOut \a gain times the pixel plus \a weight times the mean, rounded down: the same
+ * result of the convolution with the linear combination of an identity and a box filter, with exact
+ * integer arithmetic. The box extends width/2 pixels to the left and height/2 rows to the top.
  *
- * For each pixel of \a pgmIn compute the average of a 3x3 subarray centered at the pixel.
+ * The sums of the columns of the box are updated by adding the row entering the box and subtracting
+ * the one leaving it, and the sum of the box slides along the row over the column sums, so the cost
+ * per pixel does not depend on the size of the box.
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
- * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ * \param width The width of the box.
+ * \param height The height of the box.
+ * \param gain The weight of the pixel.
+ * \param weight The weight of the mean.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the box is empty.
  */
-int averagePGM(Pgm *pgmIn, Pgm* pgmOut)
+int boxPGM(Pgm* pgmIn, Pgm* pgmOut, int width, int height, int gain, int weight)
 {
-    // apply a box filter
-    Filter *bxFilter = boxFilter(3,3);
+    int i, j, k, y;
+    int lo, hi;
+    int max_val = 0;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    if(width < 1 || height < 1)
+    {
+        fprintf(stderr, "Error! Empty box. Please Check.\n");
+        return -1;
+    }
+    
+    int left = width/2;
+    int right = width-1-left;
+    int top = height/2;
+    int bottom = height-1-top;
+    int imgWidth = pgmIn->width;
+    int rowLen = imgWidth+2*left;
+    long long area = (long long)width*height;
+    
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    // The rows of the box with left halo pixels on each side
+    int* ring = (int*)malloc((size_t)height*rowLen*sizeof(int));
+    long long* colSum = (long long*)calloc(rowLen, sizeof(long long));
+    int* outPixels = (int*)malloc(imgWidth*sizeof(int));
+    
+    // The output range, as computed by stripApplyPGM() for the equivalent filter
+    haloRangePGM(pgmIn, width > 1 || height > 1, &lo, &hi);
+    double center = gain+(double)weight/area;
+    double other = (double)weight/area;
+    double outMin = fmin(center*lo, center*hi)+(area-1)*fmin(other*lo, other*hi);
+    double outMax = fmax(center*lo, center*hi)+(area-1)*fmax(other*lo, other*hi);
+    PgmFormat format = fitFormatPGM(floor(outMin - 1e-6), floor(outMax + 1e-6));
+    
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(imgWidth, pgmIn->height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    for (y = -top; y <= bottom; y++) {
+        int* row = ring+(size_t)((y+top)%height)*rowLen;
+        loadStripRow(pgmIn, y, left, row+left);
+        for (k = 0; k < rowLen; k++)
+            colSum[k] += row[k];
+    }
+    
+    for (i = 0; i < pgmIn->height; i++) {
+        int* row = ring+(size_t)((i+top)%height)*rowLen+left;
+        long long sum = 0;
+        for (k = 0; k < width; k++)
+            sum += colSum[k];
+    
+        for (j = 0; j < imgWidth; j++) {
+            if (j > 0)
+                sum += colSum[j+left+right]-colSum[j-1];
+            outPixels[j] = (int)((long long)gain*row[j]+floorDiv(weight*sum, area));
+            if (outPixels[j] > max_val)
+                max_val = outPixels[j];
+        }
+        setRowPGM(out, i, 0, imgWidth, outPixels);
+    
+        if (i+1 < pgmIn->height) {
+            // the row i-top leaves the box and the row i+bottom+1 takes its place in the ring
+            row = ring+(size_t)(i%height)*rowLen;
+            for (k = 0; k < rowLen; k++)
+                colSum[k] -= row[k];
+            loadStripRow(pgmIn, i+bottom+1, left, row+left);
+            for (k = 0; k < rowLen; k++)
+                colSum[k] += row[k];
+        }
+    }
+    
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
     
-    int ret = convolution2DPGM(pgmIn, pgmOut, bxFilter);
+    free(ring);
+    free(colSum);
+    free(outPixels);
     
-    freeFilter(&bxFilter);
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
     
-    return ret;
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return 0;
+}
+
+/*! \fn int averagePGM(Pgm* pgmIn, Pgm* pgmOut, int width, int height)
+ * \brief Apply a box filter to the image \a pgmIn. The final result is stored in \a pgmOut.
+ *
+ * For each pixel of \a pgmIn compute the average of a \a width x \a height subarray centered at the pixel
+ * (see boxPGM()).
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param width The width of the subarray.
+ * \param height The height of the subarray.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the subarray is empty.
+ */
+int averagePGM(Pgm *pgmIn, Pgm* pgmOut, int width, int height)
+{
+    return boxPGM(pgmIn, pgmOut, width, height, 0, 1);
 }
 
 /*! \fn int sharpeningPGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Sharpen an image \a pgmIn. The final result is stored in \a pgmOut.
  *
- * Apply a filter (the difference between an identity and a box filter) to the image stored in \a pgmIn.
+ * Apply a filter (the difference between twice the identity and a 3x3 box filter) to the image
+ * stored in \a pgmIn (see boxPGM()).
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
  * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
  */
 int sharpeningPGM(Pgm* pgmIn, Pgm* pgmOut)
 {
+    return boxPGM(pgmIn, pgmOut, 3, 3, 2, -1);
+}
+
+/*! \struct RecursiveGauss
+ * \brief Coefficients of the Young - van Vliet recursive Gaussian filter.
+ *
+ * The forward pass computes w[n] = B x[n] + b1 w[n-1] + b2 w[n-2] + b3 w[n-3], the backward one
+ * y[n] = B w[n] + b1 y[n+1] + b2 y[n+2] + b3 y[n+3]. Both have unit gain.
+ */
+typedef struct
+{
+    double B;          /*!< Weight of the input */
+    double b[3];       /*!< Weights of the previous outputs, already divided by b0 */
+    double gain;       /*!< Sum of the FIR kernel replaced by the filter */
+    int pad;           /*!< Number of pixels added by the border policy at each end of a line */
+} RecursiveGauss;
+
+/*! \fn void recursiveGaussCoefficients(RecursiveGauss* g, double q)
+ * \brief Set the weights of \a g to the ones of Young and van Vliet for the parameter \a q.
+ */
+void recursiveGaussCoefficients(RecursiveGauss* g, double q)
+{
+    double b0 = 1.57825+2.44413*q+1.4281*q*q+0.422205*q*q*q;
+    
+    g->b[0] = (2.44413*q+2.85619*q*q+1.26661*q*q*q)/b0;
+    g->b[1] = -(1.4281*q*q+1.26661*q*q*q)/b0;
+    g->b[2] = 0.422205*q*q*q/b0;
+    g->B = 1-(g->b[0]+g->b[1]+g->b[2]);
+}
+
+/*! \fn double recursiveGaussError(RecursiveGauss* g, Filter* filter, double* h, int len)
+ * \brief Return the largest difference between the responses to a unit step of \a g and of \a filter, scaled
+ *        to unit gain. \a h has room for the impulse response of \a g, \a len values centered on the filter.
+ */
+double recursiveGaussError(RecursiveGauss* g, Filter* filter, double* h, int len)
+{
+    int n;
+    double error = 0, step = 0;
+    int first = (len-filter->width)/2;
+    
+    memset(h, 0, len*sizeof(double));
+    h[len/2] = 1;
+    for (n = 0; n < len; n++)
+        h[n] = g->B*h[n]+g->b[0]*(n > 0 ? h[n-1] : 0)+g->b[1]*(n > 1 ? h[n-2] : 0)+g->b[2]*(n > 2 ? h[n-3] : 0);
+    for (n = len-1; n >= 0; n--)
+        h[n] = g->B*h[n]+g->b[0]*(n < len-1 ? h[n+1] : 0)+g->b[1]*(n < len-2 ? h[n+2] : 0)+
+               g->b[2]*(n < len-3 ? h[n+3] : 0);
+    
+    for (n = 0; n < len; n++) {
+        step += h[n];
+        if (n >= first && n < first+filter->width)
+            step -= filter->kernel[n-first]/g->gain;
+        if (fabs(step) > error)
+            error = fabs(step);
+    }
+    
+    return error;
+}
+
+/*! \fn RecursiveGauss recursiveGauss(double sigma)
+ * \brief Return the recursive filter equivalent to the Gauss filters of gauss1DXFilter() with sigma \a sigma.
+ *
+ * The kernels of gauss1DFilter() are proportional to exp(-x^2/sigma^2), a Gaussian of standard deviation
+ * sigma/sqrt(2), and their sum is not 1: the recursive filter is scaled by the same sum. The parameter q of
+ * Young and van Vliet for that deviation is then refined, between 80% and 105% of its value, to the one whose
+ * response to a step is closest to that of the kernel, which keeps the error at the edges lower.
+ */
+RecursiveGauss recursiveGauss(double sigma)
+{
+    int i;
+    double error, bestError = 2;
+    RecursiveGauss g;
+    double s = sigma*M_SQRT1_2;
+    double q = s >= 2.5 ? 0.98711*s-0.96330 : 3.97156-4.14554*sqrt(1-0.26891*s);
+    double bestQ = q;
+    
+    Filter* filter = gauss1DXFilter(sigma, 0);
+    g.gain = 0;
+    for (i = 0; i < filter->width; i++)
+        g.gain += filter->kernel[i];
+    g.pad = filter->width;
+    
+    // the impulse response of the recursive filter lasts longer than the kernel
+    int len = 4*filter->width+1;
+    double* h = (double*)malloc(len*sizeof(double));
+    for (i = 80; i <= 105; i++) {
+        recursiveGaussCoefficients(&g, q*i/100);
+        error = recursiveGaussError(&g, filter, h, len);
+        if (error < bestError) {
+            bestError = error;
+            bestQ = q*i/100;
+        }
+    }
+    recursiveGaussCoefficients(&g, bestQ);
+    
+    free(h);
+    freeFilter(&filter);
+    
+    return g;
+}
+
+/*! \fn void recursiveGaussLines(RecursiveGauss* g, double* w, int len)
+ * \brief Apply in place the forward and the backward passes of \a g to GAUSS_LANES interleaved lines of \a len pixels.
+ *
+ * The pixel n of the line k is w[n*GAUSS_LANES+k]: the lines are filtered together, one in each vector lane.
+ * Outside the lines the input is assumed to repeat the pixels at their ends.
+ */
+void recursiveGaussLines(RecursiveGauss* g, double* w, int len)
+{
+    int n, k;
+    double v;
+    double w1[GAUSS_LANES], w2[GAUSS_LANES], w3[GAUSS_LANES];
+    
+    for (k = 0; k < GAUSS_LANES; k++)
+        w1[k] = w2[k] = w3[k] = w[k];
+    for (n = 0; n < len; n++)
+        for (k = 0; k < GAUSS_LANES; k++) {
+            v = g->B*w[n*GAUSS_LANES+k]+g->b[0]*w1[k]+g->b[1]*w2[k]+g->b[2]*w3[k];
+            w3[k] = w2[k];
+            w2[k] = w1[k];
+            w1[k] = v;
+            w[n*GAUSS_LANES+k] = v;
+        }
+    
+    for (k = 0; k < GAUSS_LANES; k++)
+        w2[k] = w3[k] = w1[k];
+    for (n = len-1; n >= 0; n--)
+        for (k = 0; k < GAUSS_LANES; k++) {
+            v = g->B*w[n*GAUSS_LANES+k]+g->b[0]*w1[k]+g->b[1]*w2[k]+g->b[2]*w3[k];
+            w3[k] = w2[k];
+            w2[k] = w1[k];
+            w1[k] = v;
+            w[n*GAUSS_LANES+k] = v;
+        }
+}
+
+/*! \fn int floorInt(double x)
+ * \brief Return \a x rounded down, as (int)floor(x) without the library call.
+ */
+int floorInt(double x)
+{
+    int i = (int)x;
+    
+    return i - (x < i);
+}
+
+/*! \fn PgmFormat recursiveGaussFormat(Pgm* pgm, RecursiveGauss* g)
+ * \brief Return the format of the result of a pass of \a g on \a pgm, as stripApplyPGM() for the FIR filter.
+ */
+PgmFormat recursiveGaussFormat(Pgm* pgm, RecursiveGauss* g)
+{
+    int lo, hi;
+    
+    haloRangePGM(pgm, 1, &lo, &hi);
+    
+    return fitFormatPGM(floor(g->gain*lo - 1e-6), floor(g->gain*hi + 1e-6));
+}
+
+/*! \fn int recursiveGaussPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma)
+ * \brief Gaussian blur of an image \a pgmIn with recursive filters.
+ *
+ * Each row and then each column is filtered by the Young - van Vliet recursive approximation of the
+ * Gauss filters of gaussPGM(), with the same gain, so the cost per pixel does not depend on \a sigma.
+ * The lines are extended by 6 \a sigma pixels at both ends according to the border policy, and the
+ * result of each pass is rounded down as the convolutions of gaussPGM() do. On 8-bit images the result
+ * differs from that of gaussPGM() by at most 3 levels for sigma from 4 up (1 or 2 on natural images),
+ * 5 levels for sigma 2 and 13 for sigma 1, where the recursive filter is a rough approximation
+ * (see testGaussIIR()).
+ * \param pgmIn Pointer to the input Pgm image structure.
+ * \param pgmOut Pointer to the output Pgm image structure.
+ * \param sigma The sigma of the gaussians, at least 1/sqrt(2).
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int recursiveGaussPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma)
+{
+    int i, j, k, col, n;
+    
     if(!pgmIn)
     {
         fprintf(stderr, "Error! No input data. Please Check.\n");
@@ -302,21 +1047,83 @@ int sharpeningPGM(Pgm* pgmIn, Pgm* pgmOut)
         return -1;
     }
     
-    // create a identity filter
-    Filter *idFilter = identityFilter(3,3);
-    
-    // create a box filter
-    Filter *bxFilter = boxFilter(3,3);
-    
-    // sharpening
-    Filter* filter = linearAddFilter(idFilter, bxFilter, 2.0, -1.0);
-    freeFilter(&idFilter);
-    freeFilter(&bxFilter);
+    RecursiveGauss g = recursiveGauss(sigma);
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    int pad = g.pad;
+    int len = (width > height ? width : height)+2*pad;
+    
+    int* line = (int*)malloc((size_t)len*GAUSS_LANES*sizeof(int));
+    double* w = (double*)malloc((size_t)len*GAUSS_LANES*sizeof(double));
+    
+    // filter the rows, GAUSS_LANES at a time: the rows are interleaved pixel by pixel so that
+    // the copies in and out of w are sequential
+    int rowLen = width+2*pad;
+    Pgm* imgOut1 = scratchPGM(width, height, pgmIn->max_val, recursiveGaussFormat(pgmIn, &g));
+    for (i = 0; i < height; i += GAUSS_LANES) {
+        // the last block repeats its last row
+        for (k = 0; k < GAUSS_LANES; k++)
+            loadStripRow(pgmIn, i+k < height ? i+k : height-1, pad, line+k*rowLen+pad);
+        for (j = 0; j < rowLen; j++)
+            for (k = 0; k < GAUSS_LANES; k++)
+                w[j*GAUSS_LANES+k] = line[k*rowLen+j];
+        recursiveGaussLines(&g, w, rowLen);
+        for (j = 0; j < width; j++)
+            for (k = 0; k < GAUSS_LANES; k++)
+                line[k*rowLen+j] = floorInt(g.gain*w[(pad+j)*GAUSS_LANES+k]);
+        for (k = 0; k < GAUSS_LANES && i+k < height; k++)
+            setRowPGM(imgOut1, i+k, 0, width, line+k*rowLen);
+    }
     
-    resetPGM(pgmOut);
-    convolution2DPGM(pgmIn, pgmOut, filter);
+    // filter the columns, GAUSS_BLOCK at a time so that the forward pass stays in cache:
+    // the rows of the block enter the recursions of all its columns at once
+    int rows = height+2*pad;
+    double* wCols = (double*)malloc((size_t)rows*GAUSS_BLOCK*sizeof(double));
+    double edge[GAUSS_BLOCK]; // the columns before the first row and after the last
+    double* prev[3];
+    
+    PgmFormat format = recursiveGaussFormat(imgOut1, &g);
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    int max_val = 0;
+    for (col = 0; col < width; col += GAUSS_BLOCK) {
+        n = width-col < GAUSS_BLOCK ? width-col : GAUSS_BLOCK;
+        for (i = 0; i < rows; i++) {
+            double* wRow = wCols+(size_t)i*n;
+            loadSpanRow(imgOut1, i-pad, col, n, line);
+            if (i == 0)
+                for (j = 0; j < n; j++)
+                    edge[j] = line[j];
+            for (k = 0; k < 3; k++)
+                prev[k] = i > k ? wRow-(size_t)(k+1)*n : edge;
+            for (j = 0; j < n; j++)
+                wRow[j] = g.B*line[j]+g.b[0]*prev[0][j]+g.b[1]*prev[1][j]+g.b[2]*prev[2][j];
+        }
+        memcpy(edge, wCols+(size_t)(rows-1)*n, n*sizeof(double));
+        
+        for (i = rows-1; i >= pad; i--) {
+            double* wRow = wCols+(size_t)i*n;
+            for (k = 0; k < 3; k++)
+                prev[k] = i+k+1 < rows ? wRow+(size_t)(k+1)*n : edge;
+            for (j = 0; j < n; j++)
+                wRow[j] = g.B*wRow[j]+g.b[0]*prev[0][j]+g.b[1]*prev[1][j]+g.b[2]*prev[2][j];
+            if (i < pad+height) {
+                for (j = 0; j < n; j++) {
+                    line[j] = floorInt(g.gain*wRow[j]);
+                    if (line[j] > max_val)
+                        max_val = line[j];
+                }
+                setRowPGM(out, i-pad, col, n, line);
+            }
+        }
+    }
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
     
-    freeFilter(&filter);
+    freePGM(&imgOut1);
+    free(wCols);
+    free(line);
+    free(w);
     
     return 0;
 }
@@ -325,11 +1132,13 @@ int sharpeningPGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Gaussian blur of an image \a pgmIn.
  *
  * Apply as a filter two 1D Gaussian filters with the same \a sigma and matrix linear dimension \a dim.
+ * With \a dim GAUSS_IIR the filters are replaced by recursive ones (see recursiveGaussPGM()) from
+ * sigma GAUSS_IIR_MIN_SIGMA: below it they are less accurate, and not faster than the short convolutions.
  * \param pgmIn Pointer to the input Pgm image structure.
  * \param pgmOut Pointer to the output Pgm image structure.
  * \param sigma The sigma of the gaussians.
  * \param dim The dimension of the gaussian filter. If 0 it will default to the nearest odd value close to 6 sigma.
- * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or \a sigma is not positive.
  */
 int gaussPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
 {
@@ -345,8 +1154,21 @@ int gaussPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
         return -1;
     }
     
+    if (!(sigma > 0))
+    {
+        fprintf(stderr, "Error! Gauss sigma not positive. Please Check.\n");
+        return -1;
+    }
+    
+    if (dim == GAUSS_IIR) {
+        if (sigma >= GAUSS_IIR_MIN_SIGMA)
+            return recursiveGaussPGM(pgmIn, pgmOut, sigma);
+        dim = 0;
+    }
+    
     Filter* filter;
-    Pgm* imgOut1 = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
+    // The intermediate image is overwritten and widened as needed by the convolution
+    Pgm* imgOut1 = scratchPGM(pgmIn->width, pgmIn->height, pgmIn->max_val, PGM_U8);
     
     // linear X guassian filter
     filter = gauss1DXFilter(sigma, dim);
@@ -390,15 +1212,16 @@ int op39Kernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int dimX, int dimY, int
     int spanX = 1;
     int spanY = 1;
     
-    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
+    int* srcPixels = pgmIn1->pixels;
     
     int Pi = 0;  // The integral of the image subarray
     int ix = 0;
     
     // Iterate over all filter pixels
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
+    for (k=-spanY, il = ic-stride*spanY; k <= spanY; k++, il += stride)
         for (l=-spanX; l <= spanX; l++) {
-            pixels[ix] = pgmIn1->pixels[il+l];
+            pixels[ix] = srcPixels[il+l];
             Pi += pixels[ix++];
         }
     
@@ -442,72 +1265,287 @@ int op39PGM(Pgm *pgmIn, Pgm* pgmOut)
     return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 3, 3, op39Kernel);
 }
 
-/*! \fn nagaoKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
- * \brief Return the result of applying the Nagao-Matsuyama filter to a pixel of \a pgmIn1.
+/*! \fn int maskRects(const int* mask, int side, int region, int rects[][5])
+ * \brief Append to \a rects the rectangles, one row high, covered by the 1's of a \a side x \a side matrix.
  *
- * \param pgmIn1 Pointer to the Pgm structure of the input image.
- * \param pgmIn2 Not used.
- * \param kernel Not used.
- * \param spanX Not used.
- * \param spanY Not used.
- * \param ic The linear index of the central subarray pixel in \a pgmIn1.
- * \return The result of the Nagao-Matsuyama filter.
+ * Each rectangle is stored as the region \a region followed by its top, bottom, left and right
+ * coordinates relative to the central element of the matrix.
+ * \return The number of rectangles appended.
  */
-int nagaoKernel(Pgm* pgmIn1, Pgm* pgmIn2, double* kernel, int spanX, int spanY, int ic)
+int maskRects(const int* mask, int side, int region, int rects[][5])
 {
-    int k, l, il;
-    int n;
-    const int *np = NULL;
-    int pixelVals[9];
-    int ix, in;
-    double v;
-    double min_var = 585225;
-    double sel_mean = 0;
+    int k, l, first;
+    int n = 0;
+    int span = side/2;
+    
+    for (k = 0; k < side; k++)
+        for (l = 0; l < side; l++) {
+            if (mask[k*side+l] != 1)
+                continue;
+            for (first = l; l+1 < side && mask[k*side+l+1] == 1; l++)
+                ;
+            rects[n][0] = region;
+            rects[n][1] = rects[n][2] = k-span;
+            rects[n][3] = first-span;
+            rects[n][4] = l-span;
+            n++;
+        }
     
-    // Define how far to move to the left, right, top and bottom
-    // in to match the 5x5 Nagao matrixes
-    spanX = 2;
-    spanY = 2;
-    int width = pgmIn1->width;
-    
-    // Iterates over all Nagao matrixes
-    for (n=0; n<9; n++) {
-        np = nagao[n];
-        ix = 0;
-        in = 0;
-        // Iterate over all filter pixels
-        for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
-            for (l=-spanX; l <= spanX; l++, ix++) {
-                if (np[ix] == 1) {
-                    pixelVals[in] = pgmIn1->pixels[il+l]*np[ix];
-                    in++;
+    return n;
+}
+
+/*! \fn void prefixRow(Pgm* pgm, int row, int radius, int lo, int* levels, long long* sum, long long* sq)
+ * \brief Compute the prefix sums of the levels of a row of \a pgm and of their squares.
+ * \param pgm Pointer to the Pgm image structure.
+ * \param row The index of the row, possibly outside the image.
+ * \param radius The number of halo pixels on the left and on the right of the row.
+ * \param lo The value of level 0.
+ * \param levels A buffer of width + 2 \a radius pixels.
+ * \param sum The width + 2 \a radius + 1 prefix sums of the levels, starting from the left halo.
+ * \param sq The width + 2 \a radius + 1 prefix sums of the squares of the levels.
+ */
+void prefixRow(Pgm* pgm, int row, int radius, int lo, int* levels, long long* sum, long long* sq)
+{
+    int k;
+    long long v;
+    
+    loadStripRow(pgm, row, radius, levels+radius);
+    sum[0] = 0;
+    sq[0] = 0;
+    for (k = 0; k < pgm->width+2*radius; k++) {
+        v = levels[k]-lo;
+        sum[k+1] = sum[k]+v;
+        sq[k+1] = sq[k]+v*v;
+    }
+}
+
+/*! \fn int minVariancePGM(Pgm* pgmIn, Pgm* pgmOut, int radius, int rects[][5], int nRects, int nRegions)
+ * \brief Replace each pixel of \a pgmIn with the mean of the region around it with the minimum variance.
+ *
+ * The regions are unions of rectangles within \a radius of the pixel. The rectangles with the same rows
+ * share a band: the sum of the prefix sums of the pixel levels, and of their squares, over its rows. The bands
+ * are moved down by adding the prefix sums of the row entering them and subtracting those of the row leaving,
+ * so the sums over a rectangle take four lookups whatever its size. The variances are compared exactly,
+ * the ties going to the first region.
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param radius The maximum distance of the rectangles from the pixel.
+ * \param rects The region, top, bottom, left and right coordinates of each rectangle.
+ * \param nRects The number of rectangles.
+ * \param nRegions The number of regions.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the sums of the squares can overflow.
+ */
+int minVariancePGM(Pgm* pgmIn, Pgm* pgmOut, int radius, int rects[][5], int nRects, int nRegions)
+{
+    int i, j, k, b, y;
+    int lo, hi;
+    int max_val = 0;
+    int maxSize = 0;
+    int nBands = 0;
+    
+    if(!pgmIn)
+    {
+        fprintf(stderr, "Error! No input data. Please Check.\n");
+        return -1;
+    }
+    
+    if(!pgmOut)
+    {
+        fprintf(stderr, "Error! No space to store the result. Please Check.\n");
+        return -1;
+    }
+    
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    int rowLen = width+2*radius+1;
+    int ringRows = 2*radius+2;
+    
+    int* size = (int*)calloc(nRegions, sizeof(int));
+    int* band = (int*)malloc(nRects*sizeof(int));
+    int (*bandRows)[2] = malloc(nRects*sizeof(*bandRows));
+    for (k = 0; k < nRects; k++) {
+        size[rects[k][0]] += (rects[k][2]-rects[k][1]+1)*(rects[k][4]-rects[k][3]+1);
+        if (size[rects[k][0]] > maxSize)
+            maxSize = size[rects[k][0]];
+        for (b = 0; b < nBands && (bandRows[b][0] != rects[k][1] || bandRows[b][1] != rects[k][2]); b++)
+            ;
+        if (b == nBands) {
+            bandRows[b][0] = rects[k][1];
+            bandRows[b][1] = rects[k][2];
+            nBands++;
+        }
+        band[k] = b;
+    }
+    
+    // The sums of the squares of the levels must fit in a long long
+    haloRangePGM(pgmIn, radius > 0, &lo, &hi);
+    if ((double)(hi-lo)*(hi-lo)*fmax((double)(2*radius+1)*rowLen, (double)maxSize*maxSize) >= 9e18)
+    {
+        fprintf(stderr, "Error! Pixel values out of range for the variance. Please Check.\n");
+        free(size);
+        free(band);
+        free(bandRows);
+        return -1;
+    }
+    
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    // The prefix sums of the rows from i-radius to i+radius+1
+    long long* ringSum = (long long*)malloc((size_t)ringRows*rowLen*sizeof(long long));
+    long long* ringSq = (long long*)malloc((size_t)ringRows*rowLen*sizeof(long long));
+    long long* bandSum = (long long*)calloc((size_t)nBands*rowLen, sizeof(long long));
+    long long* bandSq = (long long*)calloc((size_t)nBands*rowLen, sizeof(long long));
+    long long* regionSum = (long long*)malloc(nRegions*sizeof(long long));
+    long long* regionSq = (long long*)malloc(nRegions*sizeof(long long));
+    int* levels = (int*)malloc((rowLen-1)*sizeof(int));
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, pgmIn->format) : pgmOut;
+    reformatPGM(out, pgmIn->format);
+    
+    for (y = -radius; y <= radius; y++) {
+        k = (y+radius)%ringRows;
+        prefixRow(pgmIn, y, radius, lo, levels, ringSum+(size_t)k*rowLen, ringSq+(size_t)k*rowLen);
+    }
+    for (b = 0; b < nBands; b++)
+        for (y = bandRows[b][0]; y <= bandRows[b][1]; y++)
+            for (k = 0; k < rowLen; k++) {
+                bandSum[(size_t)b*rowLen+k] += ringSum[(size_t)(y+radius)*rowLen+k];
+                bandSq[(size_t)b*rowLen+k] += ringSq[(size_t)(y+radius)*rowLen+k];
+            }
+    
+    // The band prefix sums at the left and right edges of each rectangle for the pixel in column 0
+    long long** edges = (long long**)malloc(4*nRects*sizeof(long long*));
+    for (k = 0; k < nRects; k++) {
+        edges[4*k] = bandSum+(size_t)band[k]*rowLen+radius+rects[k][3];
+        edges[4*k+1] = bandSum+(size_t)band[k]*rowLen+radius+rects[k][4]+1;
+        edges[4*k+2] = bandSq+(size_t)band[k]*rowLen+radius+rects[k][3];
+        edges[4*k+3] = bandSq+(size_t)band[k]*rowLen+radius+rects[k][4]+1;
+    }
+    
+    for (i = 0; i < height; i++) {
+        for (j = 0; j < width; j++) {
+            double minVar = HUGE_VAL;
+            long long selSum = 0;
+            int selSize = 1;
+    
+            for (k = 0; k < nRegions; k++) {
+                regionSum[k] = 0;
+                regionSq[k] = 0;
+            }
+            for (k = 0; k < nRects; k++) {
+                regionSum[rects[k][0]] += edges[4*k+1][j]-edges[4*k][j];
+                regionSq[rects[k][0]] += edges[4*k+3][j]-edges[4*k+2][j];
+            }
+    
+            // The variance is (size*sq - sum^2)/size^2, with an exact numerator
+            for (k = 0; k < nRegions; k++) {
+                double v = (double)(size[k]*regionSq[k] - regionSum[k]*regionSum[k])/((double)size[k]*size[k]);
+                if (v < minVar) {
+                    minVar = v;
+                    selSum = regionSum[k];
+                    selSize = size[k];
+                }
+            }
+    
+            // The levels are not negative: the division rounds down the mean
+            outPixels[j] = (int)(selSum/selSize)+lo;
+            if (outPixels[j] > max_val)
+                max_val = outPixels[j];
+        }
+        setRowPGM(out, i, 0, width, outPixels);
+    
+        if (i+1 < height) {
+            // move the bands down by one row
+            y = i+radius+1;
+            k = (y+radius)%ringRows;
+            prefixRow(pgmIn, y, radius, lo, levels, ringSum+(size_t)k*rowLen, ringSq+(size_t)k*rowLen);
+            for (b = 0; b < nBands; b++) {
+                size_t in = (size_t)((i+1+bandRows[b][1]+radius)%ringRows)*rowLen;
+                size_t outRow = (size_t)((i+bandRows[b][0]+radius)%ringRows)*rowLen;
+                for (k = 0; k < rowLen; k++) {
+                    bandSum[(size_t)b*rowLen+k] += ringSum[in+k]-ringSum[outRow+k];
+                    bandSq[(size_t)b*rowLen+k] += ringSq[in+k]-ringSq[outRow+k];
                 }
             }
-        
-        // Compute the variance
-        v = var(pixelVals,nagaoSize[n]);
-        
-        // Select the mean of the array with the minimum variance
-        if (v < min_var) {
-            min_var = v;
-            sel_mean = mean(pixelVals,nagaoSize[n]);
         }
     }
     
-    return (int)floor(sel_mean);
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
+    
+    free(size);
+    free(band);
+    free(bandRows);
+    free(ringSum);
+    free(ringSq);
+    free(bandSum);
+    free(bandSq);
+    free(regionSum);
+    free(regionSq);
+    free(edges);
+    free(levels);
+    free(outPixels);
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
+    
+    return 0;
 }
 
 /*! \fn int nagaoPGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Filter an image \a pgmIn with the Nagao-Matsuyama filter. The final result is stored in \a pgmOut.
  *
- * Apply a Nagao-Matsuyama filter to the image stored in \a pgmIn.
+ * Apply a Nagao-Matsuyama filter to the image stored in \a pgmIn: each pixel is replaced by the mean
+ * of the one of the nine Nagao matrixes around it with the minimum variance (see minVariancePGM()).
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
  * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
  */
 int nagaoPGM(Pgm *pgmIn, Pgm* pgmOut)
 {
-    return fapplyPGM(pgmIn, NULL, pgmOut, NULL, 5, 5, nagaoKernel);
+    int n;
+    int nRects = 0;
+    int rects[9*25][5];
+    
+    for (n=0; n<9; n++)
+        nRects += maskRects(nagao[n], 5, n, rects+nRects);
+    
+    return minVariancePGM(pgmIn, pgmOut, 2, rects, nRects, 9);
+}
+
+/*! \fn int kuwaharaPGM(Pgm* pgmIn, Pgm* pgmOut, int radius)
+ * \brief Filter an image \a pgmIn with the Kuwahara filter. The final result is stored in \a pgmOut.
+ *
+ * Each pixel is replaced by the mean of the one of the four (\a radius + 1)x(\a radius + 1) quadrants
+ * that have the pixel as a corner with the minimum variance (see minVariancePGM()).
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param radius The radius of the window.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the radius is not positive.
+ */
+int kuwaharaPGM(Pgm *pgmIn, Pgm* pgmOut, int radius)
+{
+    if(radius < 1)
+    {
+        fprintf(stderr, "Error! Kuwahara radius not positive. Please Check.\n");
+        return -1;
+    }
+    
+    int rects[4][5] = {
+        {0, -radius, 0, -radius, 0},
+        {1, -radius, 0, 0, radius},
+        {2, 0, radius, -radius, 0},
+        {3, 0, radius, 0, radius}
+    };
+    
+    return minVariancePGM(pgmIn, pgmOut, radius, rects, 4, 4);
 }
 
 // These are the pairs of neighbors in a 3x3 array to confront with
@@ -536,7 +1574,9 @@ int suppressionKernel(Pgm *pgmMod, Pgm* pgmPhi, double* kernel, int spanX, int s
     int pixels[9];
     int ix = 0;
     
-    int width = pgmMod->width;
+    int stride = pgmMod->stride;
+    int* modPixels = pgmMod->pixels;
+    int* phiPixels = pgmPhi->pixels;
     
     // Define the left, right, top and bottom span from the
     // center to match the 3x3 pixels matrix
@@ -544,13 +1584,13 @@ int suppressionKernel(Pgm *pgmMod, Pgm* pgmPhi, double* kernel, int spanX, int s
     spanY = 1;
     
     // Copy the image pixels in a local pixels array
-    for (k=-spanY, il = ic-width*spanY; k <= spanY; k++, il += width)
+    for (k=-spanY, il = ic-stride*spanY; k <= spanY; k++, il += stride)
         for (l=-spanX; l <= spanX; l++) {
-            pixels[ix++] = pgmMod->pixels[il+l];
+            pixels[ix++] = modPixels[il+l];
         }
     
     // Compute the quadrant of the phase of the central image pixel
-    int q = quadrant((int)(180.0*pgmPhi->pixels[ic]/127));
+    int q = quadrant((int)(180.0*phiPixels[ic]/127));
     
     // Check if the central pixel is the maximum along the direction
     // perpendicular to the orientation of the gradient
@@ -575,19 +1615,61 @@ int suppressionPGM(Pgm *pgmMod, Pgm *pgmPhi, Pgm *pgmOut)
     return fapplyPGM(pgmMod, pgmPhi, pgmOut, NULL, 3, 3, suppressionKernel);
 }
 
-/*! \fn int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
- * \brief Filter the image \a pgmIn with two Sobel filters alogn the vertical and horizontal direction.
- *        Returns either the magnitute or the phase based on \a phase.
+// The tangents of the limits of the directions of cannyDirection() times 2^24: the first two rounded
+// up for the gradients pointing right, the last two rounded down for the gradients pointing left.
+const static long long cannyTangents[] = {7502875, 41590878, 38796186, 6527620};
+
+/*! \fn int cannyDirection(int gx, int gy)
+ * \brief Return the quadrant of the direction of the gradient (\a gx, \a gy) without computing its angle.
  *
- * Apply the vertical and horizontal Sobel filters and returns the magnitute if \a phase is 0
- * or the phase if \a phase is 1.
+ * The result is the same of quadrant() applied to the angle in degrees of the phase computed by phasePGM(),
+ * that is rounded to 127 levels for 180 degrees. With this rounding the limits of the quadrants are the
+ * angles 17, 48, 80 and 112 times pi/127, compared with the components through their tangents.
+ * \param gx The horizontal component of the gradient (see sobelXFilter()).
+ * \param gy The vertical component of the gradient (see sobelYFilter()).
+ * \return The quadrant, an index in the table neighbors.
+ */
+int cannyDirection(int gx, int gy)
+{
+    long long ax = gx < 0 ? -(long long)gx : gx;
+    long long ay = (gy < 0 ? -(long long)gy : gy) << 24;
+    int bin;
+    
+    if (gx >= 0) {
+        if (ay < ax*cannyTangents[0])
+            return 0;
+        bin = ay < ax*cannyTangents[1] ? 1 : 2;
+    } else {
+        if (ay <= ax*cannyTangents[3])
+            return 0;
+        bin = ay <= ax*cannyTangents[2] ? 3 : 2;
+    }
+    
+    if (bin == 2)
+        return 2;
+    // the quadrants 1 and 3 swap for the negative angles
+    return (bin == 1) == (gy > 0) ? 1 : 3;
+}
+
+/*! \fn int cannyPGM(Pgm* pgmIn, Pgm* pgmOut)
+ * \brief Store in \a pgmOut the magnitude of the Sobel gradient of \a pgmIn after non-maximum suppression.
+ *
+ * The result is the same of convolution2DPGM() with sobelXFilter() and sobelYFilter(), followed by
+ * modulePGM(), phasePGM() and suppressionPGM(), but no intermediate image is stored: the gradient of each
+ * row is computed once, its direction is found by cannyDirection() and the magnitudes of the last three rows
+ * are kept to suppress the middle one. The magnitudes outside the image follow the border policy as in
+ * suppressionPGM().
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
- * \param phase Returns the phase if set to 1. Otherwise it returns the magnitude.
  * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
  */
-int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
+int cannyPGM(Pgm* pgmIn, Pgm* pgmOut)
 {
+    int i, j, k, gx, gy, a, b;
+    int lo, hi;
+    double loG, hiG;
+    int max_val = 0;
+    
     if(!pgmIn)
     {
         fprintf(stderr, "Error! No input data. Please Check.\n");
@@ -600,41 +1682,134 @@ int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
         return -1;
     }
     
-    Filter* filter;
+    int width = pgmIn->width;
+    int height = pgmIn->height;
     
-    Pgm* gx = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    // apply a sobel horizontal filter
-    filter = sobelXFilter();
-    convolution2DPGM(pgmIn, gx, filter);
-    freeFilter(&filter);
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
+    
+    // The output format is the one of the magnitude stored by modulePGM
+    haloRangePGM(pgmIn, 1, &lo, &hi);
+    double bound = 4*((double)hi-lo);
+    rangeFormatPGM(fitFormatPGM(floor(-bound - 1e-6), floor(bound + 1e-6)), &loG, &hiG);
+    PgmFormat format = fitFormatPGM(0, hypot(fmax(-loG, hiG), fmax(-loG, hiG)));
+    
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    // Three input rows and the magnitudes of three rows, with a halo pixel on each side, the row of
+    // the constant border, the directions of three rows and the output row
+    int* buffer = (int*)malloc((7*(width+2)+4*width)*sizeof(int));
+    int* top = buffer+1;
+    int* mid = top+width+2;
+    int* bottom = mid+width+2;
+    int* mods[3] = {bottom+width+2, bottom+2*(width+2), bottom+3*(width+2)};
+    int* border = bottom+4*(width+2);
+    int* dirs[3] = {border+width+1, border+2*width+1, border+3*width+1};
+    int* outPixels = border+4*width+1;
+    int* tmp;
+    int* up;
+    int* center;
+    int* down;
+    int* m;
+    int* d;
+    
+    haloRow(border, width, 1, 1);
+    loadStripRow(pgmIn, -1, 1, top);
+    loadStripRow(pgmIn, 0, 1, mid);
+    
+    // k is the next row whose gradient is computed
+    for (i = 0, k = 0; i < height; i++) {
+        for (; k <= i+1 && k < height; k++) {
+            loadStripRow(pgmIn, k+1, 1, bottom);
+            m = mods[k%3];
+            d = dirs[k%3];
+            for (j = 0; j < width; j++) {
+                gx = top[j-1] + 2*top[j] + top[j+1] - bottom[j-1] - 2*bottom[j] - bottom[j+1];
+                gy = top[j-1] + 2*mid[j-1] + bottom[j-1] - top[j+1] - 2*mid[j+1] - bottom[j+1];
+                // the squares are summed in double precision as in modulePGM
+                m[j] = (int)sqrt((double)gx*gx + (double)gy*gy);
+                d[j] = cannyDirection(gx, gy);
+            }
+            haloRow(m, width, 1, 0);
+            
+            // the rows move up by one
+            tmp = top;
+            top = mid;
+            mid = bottom;
+            bottom = tmp;
+        }
+        
+        // the rows of magnitudes outside the image are replaced as the rows of an image
+        a = borderIndex(i-1, height);
+        b = borderIndex(i+1, height);
+        up = a < 0 ? border : mods[a%3];
+        center = mods[i%3];
+        down = b < 0 ? border : mods[b%3];
+        d = dirs[i%3];
+        for (j = 0; j < width; j++) {
+            switch (d[j]) {
+                case 0:
+                    a = up[j];
+                    b = down[j];
+                    break;
+                case 1:
+                    a = up[j-1];
+                    b = down[j+1];
+                    break;
+                case 2:
+                    a = center[j-1];
+                    b = center[j+1];
+                    break;
+                default:
+                    a = up[j+1];
+                    b = down[j-1];
+            }
+            outPixels[j] = center[j] >= a && center[j] >= b ? center[j] : 0;
+            if (outPixels[j] > max_val)
+                max_val = outPixels[j];
+        }
+        setRowPGM(out, i, 0, width, outPixels);
+    }
     
-    Pgm* gy = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    // apply a sobel vertical filter
-    filter = sobelYFilter();
-    convolution2DPGM(pgmIn, gy, filter);
-    freeFilter(&filter);
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
     
-    // compute the module of the two images with the
-    // applied sobel filters
-    resetPGM(pgmOut);
+    free(buffer);
     
-    if (phase == 1) {
-        phasePGM(gx, gy, pgmOut);
-    } else
-        modulePGM(gx, gy, pgmOut);
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
     
-    freePGM(&gx);
-    freePGM(&gy);
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
     return 0;
 }
 
+/*! \fn int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
+ * \brief Filter the image \a pgmIn with two Sobel filters alogn the vertical and horizontal direction.
+ *        Returns either the magnitute or the phase based on \a phase.
+ *
+ * Apply the vertical and horizontal Sobel filters and returns the magnitute if \a phase is 0
+ * or the phase if \a phase is 1. Both filters are computed in a single pass by gradientPGM().
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param phase Returns the phase if set to 1. Otherwise it returns the magnitude.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
+{
+    return gradientPGM(pgmIn, pgmOut, 2, phase);
+}
+
 /*! \fn int prewittPGM(Pgm* pgmIn, Pgm* pgmOut, uint8_t phase)
  * \brief Filter the image \a pgmIn with two Prewitt filters alogn the vertical and horizontal direction.
  *        Returns either the magnitute or the phase based on \a phase.
  *
  * Apply the vertical and horizontal Prewitt filters and returns the magnitute if \a phase is 0
- * or the phase if \a phase is 1.
+ * or the phase if \a phase is 1. Both filters are computed in a single pass by gradientPGM().
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
  * \param phase Returns the phase if set to 1. Otherwise it returns the magnitude.
@@ -642,6 +1817,50 @@ int sobelPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
  */
 int prewittPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
 {
+    return gradientPGM(pgmIn, pgmOut, 1, phase != 0);
+}
+
+/*! \fn PgmFormat dogFormat(Pgm* pgm, double* kExt, double* kInt, int dim)
+ * \brief Return the format of a DoG of \a pgm, as stripApplyPGM() for the 2D kernel.
+ *
+ * The output range is bounded by the weights of the 2D kernel, the products of the 1D
+ * kernels \a kExt and \a kInt of \a dim values, times the input range.
+ */
+PgmFormat dogFormat(Pgm* pgm, double* kExt, double* kInt, int dim)
+{
+    int k, l, lo, hi;
+    double weight;
+    double outMin = 0, outMax = 0;
+    
+    haloRangePGM(pgm, dim > 1, &lo, &hi);
+    for (k = 0; k < dim; k++)
+        for (l = 0; l < dim; l++) {
+            weight = kExt[k]*kExt[l]-kInt[k]*kInt[l];
+            outMin += fmin(weight*lo, weight*hi);
+            outMax += fmax(weight*lo, weight*hi);
+        }
+    
+    return fitFormatPGM(floor(outMin - 1e-6), floor(outMax + 1e-6));
+}
+
+/*! \fn dogPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
+ * \brief Filter the image \a pgmIn with a DoG filter. Store the result in \a pgmOut.
+ *
+ * Apply a DoG filter to \a pgmIn. Refer to \link DoGFilter() DoGFilter() function \endlink for further information.
+ * Both Gaussians are separable: each source row is filtered once by the two 1D kernels, and each output
+ * pixel is the difference of the two column sums, rounded down once as convolution2DPGM() does with the
+ * 2D kernel. The cost per pixel is linear in \a dim.
+ * \param pgmIn Pointer to the input PGM image structure.
+ * \param pgmOut Pointer to the output PGM image structure.
+ * \param sigma The sigma of the external Gaussian.
+ * \param dim The number of rows and columns of the filter. If it is set to 0 then the dimension
+ *        is 4 \a sigma + 1. Even dimensions are rounded down to odd ones.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ */
+int dogPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
+{
+    int i, j, k, l;
+    
     if(!pgmIn)
     {
         fprintf(stderr, "Error! No input data. Please Check.\n");
@@ -654,147 +1873,372 @@ int prewittPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase)
         return -1;
     }
     
-    Filter* filter;
-    
-    Pgm* gx = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    // apply a sobel horizontal filter
-    filter = prewittXFilter();
-    convolution2DPGM(pgmIn, gx, filter);
-    freeFilter(&filter);
-    
-    Pgm* gy = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    // apply a sobel vertical filter
-    filter = prewittYFilter();
-    convolution2DPGM(pgmIn, gy, filter);
-    freeFilter(&filter);
+    fprintf(stderr, "\nDoG filtering (sigma = %f)\n",sigma);
     
-    // compute the module of the two images with the
-    // applied sobel filters
-    resetPGM(pgmOut);
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
     
-    if (phase == 0) {
-        modulePGM(gx, gy, pgmOut);
-    } else
-        phasePGM(gx, gy, pgmOut);
+    if (dim == 0)
+        dim = (int)(4*sigma)+1;
+    dim = smallestOdd(dim);
+    int span = dim/2;
+    int width = pgmIn->width;
+    int height = pgmIn->height;
     
-    freePGM(&gx);
-    freePGM(&gy);
+    // the same kernels as DoGFilter(): the 2D Gaussians are the products of these 1D ones
+    Filter* gaussExt = gauss1DXFilter(sigma, dim);
+    Filter* gaussInt = gauss1DXFilter(sigma/1.66, dim);
+    double* kExt = gaussExt->kernel;
+    double* kInt = gaussInt->kernel;
+    
+    PgmFormat format = dogFormat(pgmIn, kExt, kInt, dim);
+    Pgm* out = pgmOut == pgmIn ? scratchPGM(width, height, pgmOut->max_val, format) : pgmOut;
+    reformatPGM(out, format);
+    
+    // the last dim source rows filtered along x by both kernels, source row r in slot (r+span)%dim
+    const KernelSet* kernels = kernelsPGM();
+    int* line = (int*)malloc((width+2*span)*sizeof(int));
+    double* lineD = (double*)malloc((width+2*span)*sizeof(double));
+    double* rowsExt = (double*)malloc((size_t)dim*width*sizeof(double));
+    double* rowsInt = (double*)malloc((size_t)dim*width*sizeof(double));
+    double* sumsExt = (double*)malloc(width*sizeof(double));
+    double* sumsInt = (double*)malloc(width*sizeof(double));
+    double** taps = (double**)malloc(dim*sizeof(double*)); // the rows of the weighted sums
+    int* outPixels = (int*)malloc(width*sizeof(int));
+    int max_val = 0;
+    
+    for (i = -span; i < height+span; i++) {
+        double* rowExt = rowsExt+(size_t)((i+span)%dim)*width;
+        double* rowInt = rowsInt+(size_t)((i+span)%dim)*width;
+        loadStripRow(pgmIn, i, span, line+span);
+        for (j = 0; j < width+2*span; j++)
+            lineD[j] = line[j];
+        for (l = 0; l < dim; l++)
+            taps[l] = lineD+l;
+        kernels->weightedSumRow(rowExt, taps, kExt, dim, width);
+        kernels->weightedSumRow(rowInt, taps, kInt, dim, width);
+        
+        // the rows from i-2*span to i are loaded: filter along y the output row i-span
+        if (i < span)
+            continue;
+        for (k = 0; k < dim; k++)
+            taps[k] = rowsExt+(size_t)((i-span+k)%dim)*width;
+        kernels->weightedSumRow(sumsExt, taps, kExt, dim, width);
+        for (k = 0; k < dim; k++)
+            taps[k] = rowsInt+(size_t)((i-span+k)%dim)*width;
+        kernels->weightedSumRow(sumsInt, taps, kInt, dim, width);
+        for (j = 0; j < width; j++) {
+            outPixels[j] = (int)floor(sumsExt[j]-sumsInt[j]);
+            if (outPixels[j] > max_val)
+                max_val = outPixels[j];
+        }
+        setRowPGM(out, i-span, 0, width, outPixels);
+    }
+    storePGM(out, pgmOut);
+    pgmOut->max_val = max_val;
+    
+    freeFilter(&gaussExt);
+    freeFilter(&gaussInt);
+    free(line);
+    free(lineD);
+    free(rowsExt);
+    free(rowsInt);
+    free(sumsExt);
+    free(sumsInt);
+    free(taps);
+    free(outPixels);
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
     return 0;
 }
 
-/*! \fn dogPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
- * \brief Filter the image \a pgmIn with a DoG filter. Store the result in \a pgmOut.
+/*! \struct ScaleLevel
+ * \brief A level of the scale space of dogStackPGM(), streamed through a ring of rows.
  *
- * Apply a DoG filter to \a pgmIn. Refer to \link DoGFilter() DoGFilter() function \endlink for further information.
+ * The row r of the level is computed at the step r + delay, when the rows of its source up to r + span
+ * are available, and it covers the columns from -extent to width + extent - 1.
+ */
+typedef struct
+{
+    double sigma;      /*!< Sigma of the Gaussian blur of the input */
+    int source;        /*!< Index of the level blurred to obtain this one, -1 for the input */
+    double* kernel;    /*!< Normalized Gaussian kernel applied to the source */
+    int span;          /*!< Half width of the kernel */
+    int extent;        /*!< Number of rows and columns computed outside the image at each side */
+    int delay;         /*!< Number of rows between the last input row loaded and the last row of the level */
+    int ring;          /*!< Number of rows kept */
+    double* rows;      /*!< The last ring rows, the row r in the slot r modulo ring */
+} ScaleLevel;
+
+/*! \fn double* scaleLevelRow(ScaleLevel* level, int row, int width)
+ * \brief Return the pointer to the pixel of column 0 of the row \a row of \a level, for images \a width pixels wide.
+ */
+double* scaleLevelRow(ScaleLevel* level, int row, int width)
+{
+    int slot = (row % level->ring + level->ring) % level->ring;
+    
+    return level->rows + (size_t)slot*(width+2*level->extent) + level->extent;
+}
+
+/*! \fn int dogStackPGM(Pgm* pgmIn, Pgm** pgmOuts, double* sigmas, int n)
+ * \brief Filter the image \a pgmIn with the DoG filters of \a n sigmas \a sigmas. Store the results in \a pgmOuts.
+ *
+ * The Gaussians of all the DoG filters, with sigmas \a sigmas[k] and \a sigmas[k] / 1.66 as in
+ * DoGFilter(), form a scale space: the levels are sorted by sigma and each one is the previous one
+ * blurred by the difference sigma, so the image is blurred once per level instead of twice per filter.
+ * Levels closer than DOG_STACK_STEP to the previous one are blurred from the input instead, since the
+ * Gaussians of small sigmas are poorly sampled. All the levels are computed in a single pass over the
+ * image, each one keeping only the rows still needed by the following ones (see ScaleLevel).
+ * The levels are normalized and scaled by the sums of the kernels of dogPGM(), so the results differ
+ * from those of dogPGM() only by the truncation of its kernels and by the rounding.
  * \param pgmIn Pointer to the input PGM image structure.
- * \param pgmOut Pointer to the output PGM image structure.
- * \param sigma The sigma of the external Gaussian.
- * \param dim The number of rows and columns of the filter. If it is set to 0 then the dimension
- *        is the smallest odd number next to 6 \a sigma.
- * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ * \param pgmOuts Array of \a n pointers to the output PGM image structures.
+ * \param sigmas The sigmas of the external Gaussians.
+ * \param n The number of DoG filters.
+ * \return 0 on success, -1 if either pgmIn or pgmOuts are NULL or a sigma is not positive.
  */
-int dogPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim)
+int dogStackPGM(Pgm* pgmIn, Pgm** pgmOuts, double* sigmas, int n)
 {
+    int j, k, l, t, u, v, dim;
+    double sum;
+    
     if(!pgmIn)
     {
         fprintf(stderr, "Error! No input data. Please Check.\n");
         return -1;
     }
     
-    if(!pgmOut)
+    if(!pgmOuts)
     {
         fprintf(stderr, "Error! No space to store the result. Please Check.\n");
         return -1;
     }
     
-    Filter* filter;
+    for (k = 0; k < n; k++)
+        if (!pgmOuts[k] || pgmOuts[k] == pgmIn || !(sigmas[k] > 0))
+        {
+            fprintf(stderr, "Error! Invalid DoG stack scale. Please Check.\n");
+            return -1;
+        }
     
-    fprintf(stderr, "\nDoG filtering (sigma = %f)\n",sigma);
-    filter = DoGFilter(sigma, dim);
+    fprintf(stderr, "\nDoG stack filtering (%d sigmas)\n", n);
     
-    resetPGM(pgmOut);
-    convolution2DPGM(pgmIn, pgmOut, filter);
+    // Start Timestamp
+    struct timeval tvStart;
+    gettimeofday(&tvStart, NULL);
     
-    freeFilter(&filter);
+    int width = pgmIn->width;
+    int height = pgmIn->height;
+    const KernelSet* kernels = kernelsPGM();
+    
+    // the formats and the gains of the 2D kernels of dogPGM()
+    PgmFormat* formats = (PgmFormat*)malloc(n*sizeof(PgmFormat));
+    double* gainExt = (double*)malloc(n*sizeof(double));
+    double* gainInt = (double*)malloc(n*sizeof(double));
+    for (k = 0; k < n; k++) {
+        dim = (int)(4*sigmas[k])+1;
+        dim = smallestOdd(dim);
+        Filter* gaussExt = gauss1DXFilter(sigmas[k], dim);
+        Filter* gaussInt = gauss1DXFilter(sigmas[k]/1.66, dim);
+        formats[k] = dogFormat(pgmIn, gaussExt->kernel, gaussInt->kernel, dim);
+        gainExt[k] = gainInt[k] = 0;
+        for (l = 0; l < dim; l++) {
+            gainExt[k] += gaussExt->kernel[l];
+            gainInt[k] += gaussInt->kernel[l];
+        }
+        gainExt[k] *= gainExt[k];
+        gainInt[k] *= gainInt[k];
+        freeFilter(&gaussExt);
+        freeFilter(&gaussInt);
+    }
+    
+    // the level 0 is the input, the others have the sigmas of the Gaussians sorted and without repetitions
+    double* levelSigmas = (double*)malloc(2*n*sizeof(double));
+    for (k = 0; k < n; k++) {
+        levelSigmas[2*k] = sigmas[k];
+        levelSigmas[2*k+1] = sigmas[k]/1.66;
+    }
+    qsort(levelSigmas, 2*n, sizeof(double), compareDouble);
+    ScaleLevel* levels = (ScaleLevel*)calloc(2*n+1, sizeof(ScaleLevel));
+    int nLevels = 1;
+    levels[0].source = -1;
+    for (u = 0; u < 2*n; u++)
+        if (levelSigmas[u] != levels[nLevels-1].sigma)
+            levels[nLevels++].sigma = levelSigmas[u];
+    
+    // the kernels of the blurs and their delays
+    for (u = 1; u < nLevels; u++) {
+        double step = sqrt(levels[u].sigma*levels[u].sigma - levels[u-1].sigma*levels[u-1].sigma);
+        levels[u].source = u > 1 && step >= DOG_STACK_STEP ? u-1 : 0;
+        if (levels[u].source == 0)
+            step = levels[u].sigma;
+        levels[u].span = (int)ceil(3*step*M_SQRT1_2);
+        levels[u].kernel = (double*)malloc((2*levels[u].span+1)*sizeof(double));
+        sum = 0;
+        for (l = -levels[u].span; l <= levels[u].span; l++)
+            sum += levels[u].kernel[l+levels[u].span] = exp(-l*l/(step*step));
+        for (l = 0; l <= 2*levels[u].span; l++)
+            levels[u].kernel[l] /= sum;
+        levels[u].delay = levels[levels[u].source].delay + levels[u].span;
+    }
+    
+    // the rows and columns outside the image needed by the blurs, and the rows kept for them
+    // and for the DoG filters, that use the rows of the levels delayed by the largest delay
+    int delay = 0;
+    for (u = 0; u < nLevels; u++)
+        delay = levels[u].delay > delay ? levels[u].delay : delay;
+    for (u = nLevels-1; u >= 0; u--) {
+        levels[u].ring = u > 0 ? delay-levels[u].delay+1 : 1;
+        for (v = u+1; v < nLevels; v++)
+            if (levels[v].source == u) {
+                if (levels[v].extent+levels[v].span > levels[u].extent)
+                    levels[u].extent = levels[v].extent+levels[v].span;
+                if (2*levels[v].span+1 > levels[u].ring)
+                    levels[u].ring = 2*levels[v].span+1;
+            }
+        levels[u].rows = (double*)malloc((size_t)levels[u].ring*(width+2*levels[u].extent)*sizeof(double));
+    }
+    
+    int* line = (int*)malloc((width+2*levels[0].extent)*sizeof(int));
+    double* column = (double*)malloc((width+2*levels[0].extent)*sizeof(double));
+    double** taps = (double**)malloc((2*levels[0].extent+1)*sizeof(double*));
+    int* max_val = (int*)calloc(n, sizeof(int));
+    for (k = 0; k < n; k++)
+        reformatPGM(pgmOuts[k], formats[k]);
+    
+    // at step t the input row t is loaded, the row t - delay of each level is computed from
+    // its source and the row t - delay of the DoG filters is stored
+    for (t = -levels[0].extent; t < height+delay; t++) {
+        for (u = 0; u < nLevels; u++) {
+            ScaleLevel* level = levels+u;
+            int row = t-level->delay;
+            int extent = level->extent;
+            if (row < -extent || row >= height+extent)
+                continue;
+            double* dst = scaleLevelRow(level, row, width);
+            if (u == 0) {
+                loadStripRow(pgmIn, row, extent, line+extent);
+                for (j = -extent; j < width+extent; j++)
+                    dst[j] = line[j+extent];
+                continue;
+            }
+            
+            // blur the columns of the source and then the row
+            ScaleLevel* source = levels+level->source;
+            int span = level->span;
+            for (l = 0; l <= 2*span; l++)
+                taps[l] = scaleLevelRow(source, row-span+l, width)-extent-span;
+            kernels->weightedSumRow(column, taps, level->kernel, 2*span+1, width+2*(extent+span));
+            for (l = 0; l <= 2*span; l++)
+                taps[l] = column+l;
+            kernels->weightedSumRow(dst-extent, taps, level->kernel, 2*span+1, width+2*extent);
+        }
+        
+        if (t-delay < 0)
+            continue;
+        for (k = 0; k < n; k++) {
+            for (u = 1; levels[u].sigma != sigmas[k]; u++)
+                ;
+            for (v = 1; levels[v].sigma != sigmas[k]/1.66; v++)
+                ;
+            double* rowExt = scaleLevelRow(levels+u, t-delay, width);
+            double* rowInt = scaleLevelRow(levels+v, t-delay, width);
+            for (j = 0; j < width; j++) {
+                line[j] = floorInt(gainExt[k]*rowExt[j]-gainInt[k]*rowInt[j]);
+                if (line[j] > max_val[k])
+                    max_val[k] = line[j];
+            }
+            setRowPGM(pgmOuts[k], t-delay, 0, width, line);
+        }
+    }
+    for (k = 0; k < n; k++)
+        pgmOuts[k]->max_val = max_val[k];
+    
+    for (u = 0; u < nLevels; u++) {
+        free(levels[u].kernel);
+        free(levels[u].rows);
+    }
+    free(levels);
+    free(levelSigmas);
+    free(formats);
+    free(gainExt);
+    free(gainInt);
+    free(line);
+    free(column);
+    free(taps);
+    free(max_val);
+    
+    // Stop Timestamp
+    struct timeval tvStop;
+    gettimeofday(&tvStop, NULL);
+    
+    fprintf(stderr, "\nElapsed time (msec): %f\n", ((double)tvStop.tv_sec - (double)tvStart.tv_sec) * 1000 +
+            ((double)tvStop.tv_usec - (double)tvStart.tv_usec) / 1000);
     
     return 0;
 }
 
 /*! \fn cedPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim, int threshold_low, int threshold_high)
- * \brief Filter the image \a pgmIn with two Prewitt filters alogn the vertical and horizontal direction.
- *        Returns either the magnitute or the phase based on \a phase.
+ * \brief Store in \a pgmOut the edges of \a pgmIn found by the Canny edge detector: 255 for the edges, 0 otherwise.
  *
- * Apply the vertical and horizontal Prewitt filters and returns the magnitute if \a phase is 0
- * or the phase if \a phase is 1.
+ * The image is smoothed by gaussPGM(), then cannyPGM() computes the gradient and keeps the pixels where its
+ * magnitude is a maximum along its direction, and finally hysteresisPGM() keeps the pixels from
+ * \a threshold_high and the ones from \a threshold_low connected to them.
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
- * \param sigma The external sigma of the DoG filter. The internal sigma is set to \a sigma / 1.66 .
- * \param dim The rows and columns of the DoG filter. If set to 0 then it will be the smallest odd next to 6 \a sigma.
+ * \param sigma The sigma of the Gauss filter.
+ * \param dim The rows and columns of the Gauss filter. If set to 0 then it will be the smallest odd next to 6 \a sigma,
+ *        with GAUSS_IIR the smoothing uses recursive filters from sigma GAUSS_IIR_MIN_SIGMA (see gaussPGM()).
  * \param threshold_low Lower threshold used by the Canny algorithm.
  * \param threshold_high Hihger threshold used by the Canny algorithm.
- * \return 0 on success, -1 if either pgmIn or pgmOut are NULL.
+ * \return 0 on success, -1 if either pgmIn or pgmOut are NULL or the Gauss filter fails.
  */
 int cedPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim, int threshold_low, int threshold_high)
 {
-    int i;
-    Pgm* imgOutX = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    Pgm* imgOutY = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    Pgm* imgOutMod = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    Pgm* imgOutPhi = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-
-    gaussPGM(pgmIn, pgmOut, sigma, dim);
-    
-    Filter* gx = sobelXFilter();
-    Filter* gy = sobelYFilter();
-    
-    convolution2DPGM(pgmOut, imgOutX, gx);
-    convolution2DPGM(pgmOut, imgOutY, gy);
-    
-    modulePGM(imgOutX, imgOutY, imgOutMod);
-    phasePGM(imgOutX, imgOutY, imgOutPhi);
+    if (gaussPGM(pgmIn, pgmOut, sigma, dim) < 0)
+        return -1;
     
-    resetPGM(pgmOut);
-   
-    suppressionPGM(imgOutMod, imgOutPhi, pgmOut);
-
-    freePGM(&imgOutX);
-    freePGM(&imgOutY);
-    freePGM(&imgOutMod);
-    freePGM(&imgOutPhi);
-
-    // Find strong and weak edges with thresholding
-    Pgm *imgNH = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    thresholdPGM(pgmOut, imgNH, threshold_high);
+    // Gradient, direction and non-maximum suppression in a single pass
+    cannyPGM(pgmOut, pgmOut);
     
-    Pgm *imgNLshadow = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    thresholdPGM(pgmOut, imgNLshadow, threshold_low);
+    // Keep the weak edges connected to the strong ones
+    return hysteresisPGM(pgmOut, pgmOut, threshold_low, threshold_high);
+}
 
-    Pgm *imgNL = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
-    linearAddPGM(imgNLshadow, imgNH, 1.0, -1.0, imgNL);
-    
-    int change = 1;
-    
-    // Find 8-connected pixels in imgNL by a repeated search
+// The script operations that compute each pixel from the same pixel of the input
+const static char* pointwiseOps[] = {
+    "threshold",
+    "uniform_noise",
+    "salt_n_pepper",
+    "normalize",
+    "equalize",
+    NULL
+};
 
-    for (i=0; (i<50) && change; i++) {
-        connectivityPGM(imgNH, imgNL, pgmOut);
-        
-        change = comparePGM(imgNH, pgmOut);
-        
-        copyPGM(pgmOut, imgNH);
-    }
-    
-    copyPGM(imgNH, pgmOut);
+/*! \fn int pointwiseOp(char* name)
+ * \brief Return 1 if the script operation \a name can be applied in place.
+ * \param name The name of the operation.
+ * \return 1 for pointwise operations, 0 otherwise.
+ */
+int pointwiseOp(char* name)
+{
+    int i;
     
-    freePGM(&imgNLshadow);
-    freePGM(&imgNH);
-    freePGM(&imgNL);
+    for (i = 0; pointwiseOps[i] != NULL; i++)
+        if (strcmp(name, pointwiseOps[i]) == 0)
+            return 1;
     
     return 0;
 }
 
-/*! \fn execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
+/*! \fn execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp, char* outputFile, int binary)
  * \brief Filter the image \a pgmIn with the filters listed in file \a fp.
  *
  * The file \a fp contains a list of filters, one per line, that will be applied in sequence to
@@ -804,6 +2248,8 @@ int cedPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim, int threshold_low, in
  * \param pgmIn Pointer to the input PGM image structure.
  * \param pgmOut Pointer to the output PGM image structure.
  * \param fp Pointer to a file with the list of filters.
+ * \param outputFile The prefix of the names of the images written by the filters with several results.
+ * \param binary Write those images as binary (1) or ASCII (0) PGM files.
  *
  * \par List of implemented filters
  *
@@ -812,73 +2258,128 @@ int cedPGM(Pgm* pgmIn, Pgm* pgmOut, double sigma, int dim, int threshold_low, in
  *   - salt_n_pepper [density (default 0.05)]
  *   - normalize
  *   - equalize
- *   - median
- *   - average
+ *   - median [radius (default 1)]
+ *   - average [width (default 3)] [height (default width)]
  *   - internal_contour
  *   - operator_39
  *   - nagao
+ *   - kuwahara [radius (default 2)]
  *   - sharpening
  *   - prewitt [mod|phase (default mod)]
  *   - sobel [mod|phase (default mod)]
- *   - gauss [sigma (default 1)] [dim (default 0)]
+ *   - gauss [sigma (default 1)] [dim|iir (default 0)]
  *   - dog [sigma (default 1)] [dim (default 0)]
- *   - ced [sigma (default sqrt(2))] [threshold (default 25)]
+ *   - dog_stack sigma [sigma ...]
+ *   - ced [sigma (default sqrt(2))] [threshold (default 25)] [iir]
+ *   - label [4|8 (default 8)]
+ *   - contours
+ *   - border [replicate|reflect|constant (default replicate)] [value (default 0)]
+ *
+ * The border command selects how the following filters compute the pixels outside the image.
+ * The dog_stack command computes the DoG filters of up to DOG_STACK_MAX sigmas at once (see
+ * dogStackPGM()): each result is written to \a outputFile_dog_stack_sigma.pgm and the first one
+ * is passed to the following filters.
+ * The label command numbers the connected components of the nonzero pixels (see labelPGM()) and
+ * writes their area and bounding box to \a outputFile_label.dat.
+ * The contours command writes the borders of the components of the nonzero pixels and of their holes
+ * as chain codes to \a outputFile_contours.bin (see traceContoursPGM() and writeContours()), and leaves
+ * the image unchanged.
  */
-void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
+void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp, char* outputFile, int binary)
 {
     char buffer[64];
+    char pname[4096];
     char *ch, *cmdline;
-    int iarg;
+    int k, iarg;
     float farg;
+    double sigmas[DOG_STACK_MAX];
+    Pgm* outs[DOG_STACK_MAX];
+    Component* components;
+    Contours* contours;
+    
+    int applied;
     
-    Pgm* pgmTmp = newPGM(pgmIn->width, pgmIn->height, pgmIn->max_val);
+    Pgm* pgmTmp = scratchPGM(pgmIn->width, pgmIn->height, pgmIn->max_val, pgmIn->format);
     
-    copyPGM(pgmIn, pgmOut);
+    // The stages alternate between pgmOut and pgmTmp: src points to the result of
+    // the previous stage and dst to the image where the next one is stored
+    Pgm* src = pgmIn;
+    Pgm* dst;
     
     while (fgets(buffer,sizeof(buffer),fp)!=NULL) {
-        copyPGM(pgmOut, pgmTmp);
         // Read a line till \n or 64 char
         cmdline = trimwhitespace(buffer);
         ch = strtok(cmdline, " ");
+        if (ch == NULL) {
+            // skip empty lines
+            continue;
+        }
+        
+        // Pointwise operations work in place, except on the input image.
+        // A stage that fails leaves src to the following one
+        if (src != pgmIn && pointwiseOp(ch))
+            dst = src;
+        else
+            dst = src == pgmOut ? pgmTmp : pgmOut;
+        applied = 1;
+        
         if (strcmp(ch,"threshold")==0) {
             ch = strtok(NULL, " ");
             if (ch == NULL) {
                 iarg = 0;
             } else
                 iarg = atoi(ch);
-            thresholdPGM(pgmTmp, pgmOut, iarg);
+            applied = thresholdPGM(src, dst, iarg) == 0;
         } else if (strcmp(ch,"uniform_noise")==0) {
             ch = strtok(NULL, " ");
             if (ch == NULL) {
                 iarg = 32;
             } else
                 iarg = atoi(ch);
-            addUniformNoisePGM(pgmTmp, pgmOut, iarg);
+            applied = addUniformNoisePGM(src, dst, iarg) == 0;
         } else if (strcmp(ch,"salt_n_pepper")==0) {
             ch = strtok(NULL, " ");
             if (ch == NULL) {
                 farg = 0.05;
             } else
                 sscanf(ch,"%f",&farg);
-            addSaltPepperNoisePGM(pgmTmp, pgmOut, farg);
+            applied = addSaltPepperNoisePGM(src, dst, farg) == 0;
         } else if (strcmp(ch,"normalize")==0) {
-            normalizePGM(pgmTmp, pgmOut);
+            applied = normalizePGM(src, dst) == 0;
         } else if (strcmp(ch,"equalize")==0) {
-            equalizePGM(pgmTmp, pgmOut);
+            applied = equalizePGM(src, dst) == 0;
         } else if (strcmp(ch,"median")==0) {
+            ch = strtok(NULL, " ");
+            if (ch == NULL) {
+                iarg = 1;
+            } else
+                iarg = atoi(ch);
             fprintf(stderr,"Start median\n");
-            medianPGM(pgmTmp, pgmOut);
+            applied = medianPGM(src, dst, iarg) == 0;
             fprintf(stderr,"Median completed\n");
         } else if (strcmp(ch,"average")==0) {
-            averagePGM(pgmTmp, pgmOut);
+            ch = strtok(NULL, " ");
+            if (ch == NULL) {
+                iarg = 3;
+            } else
+                iarg = atoi(ch);
+            ch = strtok(NULL, " ");
+            applied = averagePGM(src, dst, iarg, ch == NULL ? iarg : atoi(ch)) == 0;
         } else if (strcmp(ch,"internal_contour")==0) {
-            contourN8IntPGM(pgmTmp, pgmOut);
+            applied = contourN8IntPGM(src, dst) == 0;
         } else if (strcmp(ch,"operator_39")==0) {
-            op39PGM(pgmTmp, pgmOut);
+            applied = op39PGM(src, dst) == 0;
         } else if (strcmp(ch,"nagao")==0) {
-            nagaoPGM(pgmTmp, pgmOut);
+            applied = nagaoPGM(src, dst) == 0;
+        } else if (strcmp(ch,"kuwahara")==0) {
+            ch = strtok(NULL, " ");
+            if (ch == NULL) {
+                iarg = 2;
+            } else
+                iarg = atoi(ch);
+            applied = kuwaharaPGM(src, dst, iarg) == 0;
         } else if (strcmp(ch,"sharpening")==0) {
-            sharpeningPGM(pgmTmp, pgmOut);
+            applied = sharpeningPGM(src, dst) == 0;
         } else if (strcmp(ch, "prewitt")==0) {
             ch = strtok(NULL, " ");
             if (ch==NULL) {
@@ -889,7 +2390,7 @@ void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
                 }
                 else
                     iarg = 0;
-            prewittPGM(pgmTmp, pgmOut, iarg);
+            applied = prewittPGM(src, dst, iarg) == 0;
         } else if (strcmp(ch, "sobel")==0) {
             ch = strtok(NULL, " ");
             if (ch==NULL) {
@@ -900,7 +2401,7 @@ void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
                 }
                 else
                     iarg = 0;
-            sobelPGM(pgmTmp, pgmOut, iarg);
+            applied = sobelPGM(src, dst, iarg) == 0;
         } else if (strcmp(ch, "gauss")==0) {
             ch = strtok(NULL, " ");
             if (ch==NULL) {
@@ -912,9 +2413,11 @@ void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
             if ( ch == NULL) {
                 iarg = 0;
             }
+            else if (strcmp(ch, "iir")==0)
+                iarg = GAUSS_IIR;
             else
                 iarg = atoi(ch);
-            gaussPGM(pgmTmp, pgmOut, farg, iarg);
+            applied = gaussPGM(src, dst, farg, iarg) == 0;
         } else if (strcmp(ch, "dog")==0) {
             ch = strtok(NULL, " ");
             if (ch==NULL) {
@@ -928,7 +2431,26 @@ void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
             }
             else
                 iarg = atoi(ch);
-            dogPGM(pgmTmp, pgmOut, farg, iarg);
+            applied = dogPGM(src, dst, farg, iarg) == 0;
+        } else if (strcmp(ch, "dog_stack")==0) {
+            iarg = 0;
+            while (iarg < DOG_STACK_MAX && (ch = strtok(NULL, " ")) != NULL)
+                sigmas[iarg++] = atof(ch);
+            for (k = 0; k < iarg; k++)
+                outs[k] = scratchPGM(src->width, src->height, src->max_val, src->format);
+            if (iarg > 0 && dogStackPGM(src, outs, sigmas, iarg) == 0) {
+                for (k = 0; k < iarg; k++) {
+                    snprintf(pname, sizeof(pname), "%s_dog_stack_%g.pgm", outputFile, sigmas[k]);
+                    if (binary)
+                        writeBinaryPGM(outs[k], pname);
+                    else
+                        writePGM(outs[k], pname);
+                }
+                swapPGM(dst, outs[0]);
+            } else
+                applied = 0;
+            for (k = 0; k < iarg; k++)
+                freePGM(&outs[k]);
         } else if (strcmp(ch, "ced")==0) {
             ch = strtok(NULL, " ");
             if (ch==NULL) {
@@ -942,11 +2464,54 @@ void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp)
             }
             else
                 iarg = atoi(ch);
-            cedPGM(pgmTmp, pgmOut, farg, 0, iarg, iarg*3);
-        }
+            ch = strtok(NULL, " ");
+            applied = cedPGM(src, dst, farg, (ch != NULL && strcmp(ch, "iir")==0) ? GAUSS_IIR : 0, iarg, iarg*3) == 0;
+        } else if (strcmp(ch, "label")==0) {
+            ch = strtok(NULL, " ");
+            iarg = labelPGM(src, dst, (ch != NULL && atoi(ch) == 4) ? 4 : 8, &components);
+            if (iarg >= 0) {
+                snprintf(pname, sizeof(pname), "%s_label.dat", outputFile);
+                writeComponents(components, iarg, pname);
+                free(components);
+            } else
+                applied = 0;
+        } else if (strcmp(ch, "contours")==0) {
+            contours = traceContoursPGM(src);
+            if (contours != NULL) {
+                snprintf(pname, sizeof(pname), "%s_contours.bin", outputFile);
+                writeContours(contours, pname);
+                freeContours(&contours);
+            }
+            applied = 0;
+        } else if (strcmp(ch, "border")==0) {
+            BorderPolicy policy = BORDER_REPLICATE;
+            ch = strtok(NULL, " ");
+            if (ch != NULL) {
+                if (strcmp(ch, "reflect") == 0)
+                    policy = BORDER_REFLECT;
+                else if (strcmp(ch, "constant") == 0)
+                    policy = BORDER_CONSTANT;
+            }
+            ch = strtok(NULL, " ");
+            if (ch == NULL) {
+                iarg = 0;
+            } else
+                iarg = atoi(ch);
+            borderPGM(policy, iarg);
+            applied = 0;
+        } else
+            applied = 0;
         
+        if (applied)
+            src = dst;
     }
     
+    // Move the result of the last stage to pgmOut
+    if (src == pgmIn)
+        copyPGM(pgmIn, pgmOut);
+    else if (src == pgmTmp)
+        swapPGM(pgmOut, pgmTmp);
+    
     freePGM(&pgmTmp);
     return;
 }
\ No newline at end of file
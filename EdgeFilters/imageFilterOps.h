@@ -19,6 +19,51 @@
 #define TRUE 1
 #define FALSE 0
 
+/*! \def MEDIAN_LEVELS
+ *  \brief Maximum range of values that medianPGM() maps directly to the levels of its histogram
+ */
+#define MEDIAN_LEVELS 65536
+
+/*! \def MEDIAN_BUCKET
+ *  \brief Number of consecutive levels counted together by the coarse histogram of medianPGM()
+ */
+#define MEDIAN_BUCKET 256
+
+/*! \def MEDIAN_BLOCK
+ *  \brief Number of adjacent pixels whose 3x3 or 5x5 medians are computed together by medianPGM()
+ */
+#define MEDIAN_BLOCK 256
+
+/*! \def GAUSS_IIR
+ *  \brief Dimension of the Gauss filter that makes gaussPGM() use recursive filters
+ */
+#define GAUSS_IIR -1
+
+/*! \def GAUSS_IIR_MIN_SIGMA
+ *  \brief Smallest sigma for which gaussPGM() uses the recursive filters, within 3 levels of the convolutions
+ */
+#define GAUSS_IIR_MIN_SIGMA 4
+
+/*! \def GAUSS_LANES
+ *  \brief Number of rows filtered together by the recursive filters of gaussPGM()
+ */
+#define GAUSS_LANES 8
+
+/*! \def GAUSS_BLOCK
+ *  \brief Number of columns filtered together by the recursive filters of gaussPGM()
+ */
+#define GAUSS_BLOCK 64
+
+/*! \def DOG_STACK_MAX
+ *  \brief Maximum number of sigmas of the dog_stack script command
+ */
+#define DOG_STACK_MAX 16
+
+/*! \def DOG_STACK_STEP
+ *  \brief Smallest difference of sigma between two levels of the scale space of dogStackPGM()
+ */
+#define DOG_STACK_STEP 1.0
+
 Filter *linearAddFilter(Filter* filterOp1, Filter* filterOp2, double w1, double w2);
 
 //---------------------------------------------------------//
@@ -27,8 +72,8 @@ Filter *linearAddFilter(Filter* filterOp1, Filter* filterOp2, double w1, double
 int addUniformNoisePGM(Pgm* pgmIn, Pgm* pgmOut, int range);
 int addSaltPepperNoisePGM(Pgm* pgmIn, Pgm* pgmOut, double prob);
 
-int medianPGM(Pgm *pgmIn, Pgm* pgmOut);
-int averagePGM(Pgm *pgmIn, Pgm* pgmOut);
+int medianPGM(Pgm *pgmIn, Pgm* pgmOut, int radius);
+int averagePGM(Pgm *pgmIn, Pgm* pgmOut, int width, int height);
 
 int sharpeningPGM(Pgm* imgIn, Pgm* imgOut);
 int gaussPGM(Pgm* imgIn, Pgm* imgOut, double sigma, int dim);
@@ -39,13 +84,16 @@ int gaussPGM(Pgm* imgIn, Pgm* imgOut, double sigma, int dim);
 
 int op39PGM(Pgm *pgmIn, Pgm* pgmOut);
 int nagaoPGM(Pgm *pgmIn, Pgm* pgmOut);
+int kuwaharaPGM(Pgm *pgmIn, Pgm* pgmOut, int radius);
 int suppressionPGM(Pgm *pgmMod, Pgm *pgmPhi, Pgm *pgmOut);
+int cannyPGM(Pgm* pgmIn, Pgm* pgmOut);
 
 int sobelPGM(Pgm* imgIn, Pgm* imgOut, unsigned int phase);
 int prewittPGM(Pgm* pgmIn, Pgm* pgmOut, unsigned int phase);
 int dogPGM(Pgm* imgIn, Pgm* imgOut, double sigma, int dim);
+int dogStackPGM(Pgm* pgmIn, Pgm** pgmOuts, double* sigmas, int n);
 int cedPGM(Pgm* imgIn, Pgm* imgOut, double sigma, int dim, int threshold, int thresholdRatio);
 
-void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp);
+void execImageOps(Pgm *pgmIn, Pgm* pgmOut, FILE *fp, char* outputFile, int binary);
 
 #endif /* imageFilterOps_H */
@@ -74,6 +74,71 @@ void printFilter(Filter* filter)
     }
 }
 
+/*! \fn int separateFilter(Filter* filter, double* cols, double* rows, int maxRank)
+ * \brief Decompose the kernel of \a filter in a sum of outer products of a column and a row.
+ *
+ * The terms are found by elimination with complete pivoting: each one is the column and the row of the
+ * residual kernel through its largest weight, divided by that weight, and it is subtracted from the residual.
+ * The decomposition stops when all the residual weights are within SEPARABLE_TOL times the largest weight,
+ * so the number of terms is the rank of the kernel. Kernels made of small integers, as Sobel and Prewitt,
+ * are decomposed exactly.
+ * \param filter The pointer to the Filter.
+ * \param cols The \a maxRank columns of \a filter->height values, one after the other.
+ * \param rows The \a maxRank rows of \a filter->width values, one after the other.
+ * \param maxRank The largest number of terms.
+ * \return The number of terms, 0 if the kernel needs more than \a maxRank of them.
+ */
+int separateFilter(Filter* filter, double* cols, double* rows, int maxRank)
+{
+    int i, k, l, p, q, rank;
+    double pivot;
+    double largest = 0;
+    
+    if (!filter) {
+        fprintf(stderr, "Error! No filter defined. Please Check.\n");
+        return 0;
+    }
+    
+    int width = filter->width;
+    int height = filter->height;
+    double* residual = (double*)malloc(width*height*sizeof(double));
+    
+    memcpy(residual, filter->kernel, width*height*sizeof(double));
+    for (i = 0; i < width*height; i++)
+        largest = fmax(largest, fabs(residual[i]));
+    
+    for (rank = 0; ; rank++) {
+        // the largest residual weight
+        p = q = 0;
+        pivot = 0;
+        for (k = 0; k < height; k++)
+            for (l = 0; l < width; l++)
+                if (fabs(residual[k*width+l]) > fabs(pivot)) {
+                    pivot = residual[k*width+l];
+                    p = k;
+                    q = l;
+                }
+        if (fabs(pivot) <= SEPARABLE_TOL*largest)
+            break;
+        if (rank == maxRank) {
+            rank = 0;
+            break;
+        }
+        
+        for (k = 0; k < height; k++)
+            cols[rank*height+k] = residual[k*width+q];
+        for (l = 0; l < width; l++)
+            rows[rank*width+l] = residual[p*width+l]/pivot;
+        for (k = 0; k < height; k++)
+            for (l = 0; l < width; l++)
+                residual[k*width+l] -= cols[rank*height+k]*rows[rank*width+l];
+    }
+    
+    free(residual);
+    
+    return rank;
+}
+
 /*! \fn Filter* identityFilter(int width, int height)
  * \brief It creates an identity Filter.
  *
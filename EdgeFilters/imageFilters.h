@@ -21,6 +21,11 @@
  */
 #define smallestOdd(x) x%2 == 1? x: x-1
 
+/*! \def SEPARABLE_TOL
+ *    \brief Largest weight, relative to the largest one, left out by separateFilter().
+ */
+#define SEPARABLE_TOL 1e-9
+
 /*! \struct Filter
  *    \brief The structure used for image filters.
  */
@@ -38,6 +43,7 @@ typedef struct
 Filter* newFilter(int width, int height);
 void freeFilter(Filter** filter);
 void printFilter(Filter* filter);
+int separateFilter(Filter* filter, double* cols, double* rows, int maxRank);
 
 //---------------------------------------------------------//
 //---------------------- Basic Filters --------------------//
@@ -0,0 +1,811 @@
+/*! \file imageKernels.c
+ *  \brief Row kernels compiled for several instruction sets and selected at run time.
+ *
+ *  Each kernel has a scalar version and, on x86, SSE4.2, AVX2 and AVX-512 versions compiled with the
+ *  target attribute, so the same binary runs on any CPU. The vector versions process many adjacent
+ *  pixels at once, each in its own lane, with the same operations in the same order of the scalar one.
+ *  Floating point contraction must be disabled (-ffp-contract=off), otherwise the compiler fuses the
+ *  multiplications and additions of the AVX-512 kernels and their results differ from the scalar ones.
+ *  \author Gianluca Gerard
+ *  \copyright Apache License Version 2.0, January 2004
+ */
+
+#include "imageKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#if defined(__clang__) || __GNUC__ >= 5
+#define KERNELS_AVX512
+#endif
+#endif
+
+//---------------------------------------------------------//
+//--------------------- Scalar kernels --------------------//
+//---------------------------------------------------------//
+
+/*! \fn void convolutionTail(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int j, int* out)
+ * \brief Convolve the pixels of a strip row from column \a j to the end of the row.
+ *
+ * The products of the pixels with the kernel values are summed in double precision and the sum is
+ * rounded down, as in convolution2DKernel().
+ * \param pgmIn1 Pointer to the strip.
+ * \param kernel Pointer to convolution matrix.
+ * \param spanX The number of columns to the left and right of the central column of the image subarray.
+ * \param spanY The number of rows to the top and to the bottom of the central row of the image subarray.
+ * \param ic The linear index in \a pgmIn1 of the first pixel of the row.
+ * \param j The first column to convolve.
+ * \param out Pointer to the buffer where the row is stored.
+ */
+void convolutionTail(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int j, int* out)
+{
+    int k, l, il, ix;
+    double sum;
+    int stride = pgmIn1->stride;
+    int* pixels = pgmIn1->pixels;
+    
+    for (; j < pgmIn1->width; j++) {
+        sum = 0;
+        ix = 0;
+        // Iterate over all filter pixels
+        for (k=-spanY, il = ic+j-stride*spanY; k <= spanY; k++, il += stride)
+            for (l=-spanX; l <= spanX; l++)
+                sum += pixels[il+l]*kernel[ix++];
+        out[j] = (int)floor(sum);
+    }
+}
+
+void convolutionRowScalar(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int* out)
+{
+    convolutionTail(pgmIn1, kernel, spanX, spanY, ic, 0, out);
+}
+
+/*! \fn void gradientTail(int* top, int* mid, int* bottom, int j, int width, int weight, unsigned int phase, int* out)
+ * \brief Compute the gradient of a row from column \a j to the end of the row.
+ *
+ * The horizontal component is the convolution with the filters of sobelXFilter() or prewittXFilter(), the
+ * vertical one with those of sobelYFilter() or prewittYFilter(). The rows must have one halo pixel on each side.
+ * \param top Pointer to the first pixel of the row above.
+ * \param mid Pointer to the first pixel of the row.
+ * \param bottom Pointer to the first pixel of the row below.
+ * \param j The first column to compute.
+ * \param width The number of pixels in the row.
+ * \param weight The weight of the central taps: 2 for Sobel, 1 for Prewitt.
+ * \param phase Compute the phase if set to 1. Otherwise the magnitude.
+ * \param out Pointer to the row where the result is stored.
+ */
+void gradientTail(int* top, int* mid, int* bottom, int j, int width, int weight, unsigned int phase, int* out)
+{
+    int gx, gy;
+    
+    for (; j < width; j++) {
+        gx = top[j-1] + weight*top[j] + top[j+1] - bottom[j-1] - weight*bottom[j] - bottom[j+1];
+        gy = top[j-1] + weight*mid[j-1] + bottom[j-1] - top[j+1] - weight*mid[j+1] - bottom[j+1];
+        if (phase == 1)
+            out[j] = (int)(atan2(gy, gx)*M_1_PI*127);
+        else
+            // the squares are summed in double precision as in modulePGM
+            out[j] = (int)sqrt((double)gx*gx + (double)gy*gy);
+    }
+}
+
+void gradientRowScalar(int* top, int* mid, int* bottom, int width, int weight, unsigned int phase, int* out)
+{
+    gradientTail(top, mid, bottom, 0, width, weight, phase, out);
+}
+
+/*! \fn void rangeTail(int* pixels, int j, int len, int* min, int* max)
+ * \brief Update \a min and \a max with the values of \a pixels from index \a j to \a len - 1.
+ */
+void rangeTail(int* pixels, int j, int len, int* min, int* max)
+{
+    for (; j < len; j++) {
+        if (pixels[j] < *min)
+            *min = pixels[j];
+        if (pixels[j] > *max)
+            *max = pixels[j];
+    }
+}
+
+void rangeRowScalar(int* pixels, int len, int* min, int* max)
+{
+    rangeTail(pixels, 0, len, min, max);
+}
+
+/*! \fn void compareTail(int* a, int* b, int j, int len)
+ * \brief Compare and exchange the values of \a a and \a b from index \a j to \a len - 1.
+ *
+ * After the exchange \a a holds the smaller value of each pair and \a b the larger one.
+ */
+void compareTail(int* a, int* b, int j, int len)
+{
+    int lo;
+    
+    for (; j < len; j++) {
+        lo = a[j] < b[j] ? a[j] : b[j];
+        b[j] = a[j] < b[j] ? b[j] : a[j];
+        a[j] = lo;
+    }
+}
+
+void compareRowScalar(int* a, int* b, int len)
+{
+    compareTail(a, b, 0, len);
+}
+
+/*! \fn void minTail(int* dst, int* a, int* b, int j, int len)
+ * \brief Store in \a dst the smaller of the values of \a a and \a b from index \a j to \a len - 1.
+ */
+void minTail(int* dst, int* a, int* b, int j, int len)
+{
+    for (; j < len; j++)
+        dst[j] = a[j] < b[j] ? a[j] : b[j];
+}
+
+void minRowScalar(int* dst, int* a, int* b, int len)
+{
+    minTail(dst, a, b, 0, len);
+}
+
+/*! \fn void maxTail(int* dst, int* a, int* b, int j, int len)
+ * \brief Store in \a dst the larger of the values of \a a and \a b from index \a j to \a len - 1.
+ */
+void maxTail(int* dst, int* a, int* b, int j, int len)
+{
+    for (; j < len; j++)
+        dst[j] = a[j] < b[j] ? b[j] : a[j];
+}
+
+void maxRowScalar(int* dst, int* a, int* b, int len)
+{
+    maxTail(dst, a, b, 0, len);
+}
+
+/*! \fn void weightedSumTail(double* dst, double** rows, double* weights, int n, int j, int len)
+ * \brief Store in \a dst the sum of the \a n rows \a rows times \a weights from index \a j to \a len - 1.
+ *
+ * The products are added in the order of the rows.
+ */
+void weightedSumTail(double* dst, double** rows, double* weights, int n, int j, int len)
+{
+    int k;
+    double sum;
+    
+    for (; j < len; j++) {
+        sum = 0;
+        for (k = 0; k < n; k++)
+            sum += rows[k][j]*weights[k];
+        dst[j] = sum;
+    }
+}
+
+void weightedSumRowScalar(double* dst, double** rows, double* weights, int n, int len)
+{
+    weightedSumTail(dst, rows, weights, n, 0, len);
+}
+
+int supportsScalar(void)
+{
+    return 1;
+}
+
+#ifdef KERNELS_X86
+//---------------------------------------------------------//
+//--------------------- SSE4.2 kernels --------------------//
+//---------------------------------------------------------//
+
+__attribute__((target("sse4.2")))
+void convolutionRowSSE42(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int* out)
+{
+    int j, k, l, il, ix;
+    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
+    int* pixels = pgmIn1->pixels;
+    const int* p;
+    __m128i a, b;
+    __m128d w, s0, s1, s2, s3;
+    
+    // 8 pixels for iteration, 2 for each accumulator
+    for (j = 0; j+8 <= width; j += 8) {
+        s0 = s1 = s2 = s3 = _mm_setzero_pd();
+        ix = 0;
+        for (k=-spanY, il = ic+j-stride*spanY; k <= spanY; k++, il += stride)
+            for (l=-spanX; l <= spanX; l++) {
+                w = _mm_set1_pd(kernel[ix++]);
+                p = pixels+il+l;
+                a = _mm_loadu_si128((const __m128i*)p);
+                b = _mm_loadu_si128((const __m128i*)(p+4));
+                s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_cvtepi32_pd(a), w));
+                s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(a, 8)), w));
+                s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_cvtepi32_pd(b), w));
+                s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(b, 8)), w));
+            }
+        a = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_floor_pd(s0)), _mm_cvttpd_epi32(_mm_floor_pd(s1)));
+        b = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_floor_pd(s2)), _mm_cvttpd_epi32(_mm_floor_pd(s3)));
+        _mm_storeu_si128((__m128i*)(out+j), a);
+        _mm_storeu_si128((__m128i*)(out+j+4), b);
+    }
+    
+    convolutionTail(pgmIn1, kernel, spanX, spanY, ic, j, out);
+}
+
+__attribute__((target("sse4.2")))
+void gradientRowSSE42(int* top, int* mid, int* bottom, int width, int weight, unsigned int phase, int* out)
+{
+    int j, k;
+    // the weight is a power of 2, the central taps are shifted
+    __m128i shift = _mm_cvtsi32_si128(weight >> 1);
+    __m128i l, c, r, sumT, sumB, vx, vy;
+    __m128d x, y;
+    int ax[4], ay[4];
+    
+    for (j = 0; j+4 <= width; j += 4) {
+        l = _mm_loadu_si128((const __m128i*)(top+j-1));
+        c = _mm_loadu_si128((const __m128i*)(top+j));
+        r = _mm_loadu_si128((const __m128i*)(top+j+1));
+        sumT = _mm_add_epi32(_mm_add_epi32(l, r), _mm_sll_epi32(c, shift));
+        vy = _mm_sub_epi32(l, r);
+    
+        l = _mm_loadu_si128((const __m128i*)(mid+j-1));
+        r = _mm_loadu_si128((const __m128i*)(mid+j+1));
+        vy = _mm_add_epi32(vy, _mm_sll_epi32(_mm_sub_epi32(l, r), shift));
+    
+        l = _mm_loadu_si128((const __m128i*)(bottom+j-1));
+        c = _mm_loadu_si128((const __m128i*)(bottom+j));
+        r = _mm_loadu_si128((const __m128i*)(bottom+j+1));
+        sumB = _mm_add_epi32(_mm_add_epi32(l, r), _mm_sll_epi32(c, shift));
+        vy = _mm_add_epi32(vy, _mm_sub_epi32(l, r));
+        vx = _mm_sub_epi32(sumT, sumB);
+    
+        if (phase == 1) {
+            _mm_storeu_si128((__m128i*)ax, vx);
+            _mm_storeu_si128((__m128i*)ay, vy);
+            for (k = 0; k < 4; k++)
+                out[j+k] = (int)(atan2(ay[k], ax[k])*M_1_PI*127);
+        } else {
+            x = _mm_cvtepi32_pd(vx);
+            y = _mm_cvtepi32_pd(vy);
+            c = _mm_cvttpd_epi32(_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))));
+            x = _mm_cvtepi32_pd(_mm_srli_si128(vx, 8));
+            y = _mm_cvtepi32_pd(_mm_srli_si128(vy, 8));
+            r = _mm_cvttpd_epi32(_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))));
+            _mm_storeu_si128((__m128i*)(out+j), _mm_unpacklo_epi64(c, r));
+        }
+    }
+    
+    gradientTail(top, mid, bottom, j, width, weight, phase, out);
+}
+
+__attribute__((target("sse4.2")))
+void rangeRowSSE42(int* pixels, int len, int* min, int* max)
+{
+    int j, k;
+    int lanesMin[4], lanesMax[4];
+    __m128i v;
+    __m128i vmin = _mm_set1_epi32(*min);
+    __m128i vmax = _mm_set1_epi32(*max);
+    
+    for (j = 0; j+4 <= len; j += 4) {
+        v = _mm_loadu_si128((const __m128i*)(pixels+j));
+        vmin = _mm_min_epi32(vmin, v);
+        vmax = _mm_max_epi32(vmax, v);
+    }
+    _mm_storeu_si128((__m128i*)lanesMin, vmin);
+    _mm_storeu_si128((__m128i*)lanesMax, vmax);
+    for (k = 0; k < 4; k++) {
+        if (lanesMin[k] < *min)
+            *min = lanesMin[k];
+        if (lanesMax[k] > *max)
+            *max = lanesMax[k];
+    }
+    
+    rangeTail(pixels, j, len, min, max);
+}
+
+__attribute__((target("sse4.2")))
+void compareRowSSE42(int* a, int* b, int len)
+{
+    int j;
+    __m128i va, vb;
+    
+    for (j = 0; j+4 <= len; j += 4) {
+        va = _mm_loadu_si128((const __m128i*)(a+j));
+        vb = _mm_loadu_si128((const __m128i*)(b+j));
+        _mm_storeu_si128((__m128i*)(a+j), _mm_min_epi32(va, vb));
+        _mm_storeu_si128((__m128i*)(b+j), _mm_max_epi32(va, vb));
+    }
+    
+    compareTail(a, b, j, len);
+}
+
+__attribute__((target("sse4.2")))
+void minRowSSE42(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+4 <= len; j += 4)
+        _mm_storeu_si128((__m128i*)(dst+j), _mm_min_epi32(_mm_loadu_si128((const __m128i*)(a+j)), _mm_loadu_si128((const __m128i*)(b+j))));
+    
+    minTail(dst, a, b, j, len);
+}
+
+__attribute__((target("sse4.2")))
+void maxRowSSE42(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+4 <= len; j += 4)
+        _mm_storeu_si128((__m128i*)(dst+j), _mm_max_epi32(_mm_loadu_si128((const __m128i*)(a+j)), _mm_loadu_si128((const __m128i*)(b+j))));
+    
+    maxTail(dst, a, b, j, len);
+}
+
+__attribute__((target("sse4.2")))
+void weightedSumRowSSE42(double* dst, double** rows, double* weights, int n, int len)
+{
+    int j, k;
+    const double* p;
+    __m128d w, s0, s1, s2, s3;
+    
+    // 8 pixels for iteration, 2 for each accumulator
+    for (j = 0; j+8 <= len; j += 8) {
+        s0 = s1 = s2 = s3 = _mm_setzero_pd();
+        for (k = 0; k < n; k++) {
+            w = _mm_set1_pd(weights[k]);
+            p = rows[k]+j;
+            s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(p), w));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(p+2), w));
+            s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_loadu_pd(p+4), w));
+            s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_loadu_pd(p+6), w));
+        }
+        _mm_storeu_pd(dst+j, s0);
+        _mm_storeu_pd(dst+j+2, s1);
+        _mm_storeu_pd(dst+j+4, s2);
+        _mm_storeu_pd(dst+j+6, s3);
+    }
+    
+    weightedSumTail(dst, rows, weights, n, j, len);
+}
+
+int supportsSSE42(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+//---------------------------------------------------------//
+//---------------------- AVX2 kernels ---------------------//
+//---------------------------------------------------------//
+
+__attribute__((target("avx2")))
+void convolutionRowAVX2(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int* out)
+{
+    int j, k, l, il, ix;
+    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
+    int* pixels = pgmIn1->pixels;
+    const int* p;
+    __m256d w, s0, s1, s2, s3;
+    
+    // 16 pixels for iteration, 4 for each accumulator
+    for (j = 0; j+16 <= width; j += 16) {
+        s0 = s1 = s2 = s3 = _mm256_setzero_pd();
+        ix = 0;
+        for (k=-spanY, il = ic+j-stride*spanY; k <= spanY; k++, il += stride)
+            for (l=-spanX; l <= spanX; l++) {
+                w = _mm256_set1_pd(kernel[ix++]);
+                p = pixels+il+l;
+                s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)p)), w));
+                s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(p+4))), w));
+                s2 = _mm256_add_pd(s2, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(p+8))), w));
+                s3 = _mm256_add_pd(s3, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(p+12))), w));
+            }
+        _mm_storeu_si128((__m128i*)(out+j), _mm256_cvttpd_epi32(_mm256_floor_pd(s0)));
+        _mm_storeu_si128((__m128i*)(out+j+4), _mm256_cvttpd_epi32(_mm256_floor_pd(s1)));
+        _mm_storeu_si128((__m128i*)(out+j+8), _mm256_cvttpd_epi32(_mm256_floor_pd(s2)));
+        _mm_storeu_si128((__m128i*)(out+j+12), _mm256_cvttpd_epi32(_mm256_floor_pd(s3)));
+    }
+    
+    convolutionTail(pgmIn1, kernel, spanX, spanY, ic, j, out);
+}
+
+__attribute__((target("avx2")))
+void gradientRowAVX2(int* top, int* mid, int* bottom, int width, int weight, unsigned int phase, int* out)
+{
+    int j, k;
+    // the weight is a power of 2, the central taps are shifted
+    __m128i shift = _mm_cvtsi32_si128(weight >> 1);
+    __m256i l, c, r, sumT, sumB, vx, vy;
+    __m256d x, y;
+    int ax[8], ay[8];
+    
+    for (j = 0; j+8 <= width; j += 8) {
+        l = _mm256_loadu_si256((const __m256i*)(top+j-1));
+        c = _mm256_loadu_si256((const __m256i*)(top+j));
+        r = _mm256_loadu_si256((const __m256i*)(top+j+1));
+        sumT = _mm256_add_epi32(_mm256_add_epi32(l, r), _mm256_sll_epi32(c, shift));
+        vy = _mm256_sub_epi32(l, r);
+    
+        l = _mm256_loadu_si256((const __m256i*)(mid+j-1));
+        r = _mm256_loadu_si256((const __m256i*)(mid+j+1));
+        vy = _mm256_add_epi32(vy, _mm256_sll_epi32(_mm256_sub_epi32(l, r), shift));
+    
+        l = _mm256_loadu_si256((const __m256i*)(bottom+j-1));
+        c = _mm256_loadu_si256((const __m256i*)(bottom+j));
+        r = _mm256_loadu_si256((const __m256i*)(bottom+j+1));
+        sumB = _mm256_add_epi32(_mm256_add_epi32(l, r), _mm256_sll_epi32(c, shift));
+        vy = _mm256_add_epi32(vy, _mm256_sub_epi32(l, r));
+        vx = _mm256_sub_epi32(sumT, sumB);
+    
+        if (phase == 1) {
+            _mm256_storeu_si256((__m256i*)ax, vx);
+            _mm256_storeu_si256((__m256i*)ay, vy);
+            for (k = 0; k < 8; k++)
+                out[j+k] = (int)(atan2(ay[k], ax[k])*M_1_PI*127);
+        } else {
+            x = _mm256_cvtepi32_pd(_mm256_castsi256_si128(vx));
+            y = _mm256_cvtepi32_pd(_mm256_castsi256_si128(vy));
+            _mm_storeu_si128((__m128i*)(out+j),
+                             _mm256_cvttpd_epi32(_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)))));
+            x = _mm256_cvtepi32_pd(_mm256_extracti128_si256(vx, 1));
+            y = _mm256_cvtepi32_pd(_mm256_extracti128_si256(vy, 1));
+            _mm_storeu_si128((__m128i*)(out+j+4),
+                             _mm256_cvttpd_epi32(_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)))));
+        }
+    }
+    
+    gradientTail(top, mid, bottom, j, width, weight, phase, out);
+}
+
+__attribute__((target("avx2")))
+void rangeRowAVX2(int* pixels, int len, int* min, int* max)
+{
+    int j, k;
+    int lanesMin[8], lanesMax[8];
+    __m256i v;
+    __m256i vmin = _mm256_set1_epi32(*min);
+    __m256i vmax = _mm256_set1_epi32(*max);
+    
+    for (j = 0; j+8 <= len; j += 8) {
+        v = _mm256_loadu_si256((const __m256i*)(pixels+j));
+        vmin = _mm256_min_epi32(vmin, v);
+        vmax = _mm256_max_epi32(vmax, v);
+    }
+    _mm256_storeu_si256((__m256i*)lanesMin, vmin);
+    _mm256_storeu_si256((__m256i*)lanesMax, vmax);
+    for (k = 0; k < 8; k++) {
+        if (lanesMin[k] < *min)
+            *min = lanesMin[k];
+        if (lanesMax[k] > *max)
+            *max = lanesMax[k];
+    }
+    
+    rangeTail(pixels, j, len, min, max);
+}
+
+__attribute__((target("avx2")))
+void compareRowAVX2(int* a, int* b, int len)
+{
+    int j;
+    __m256i va, vb;
+    
+    for (j = 0; j+8 <= len; j += 8) {
+        va = _mm256_loadu_si256((const __m256i*)(a+j));
+        vb = _mm256_loadu_si256((const __m256i*)(b+j));
+        _mm256_storeu_si256((__m256i*)(a+j), _mm256_min_epi32(va, vb));
+        _mm256_storeu_si256((__m256i*)(b+j), _mm256_max_epi32(va, vb));
+    }
+    
+    compareTail(a, b, j, len);
+}
+
+__attribute__((target("avx2")))
+void minRowAVX2(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+8 <= len; j += 8)
+        _mm256_storeu_si256((__m256i*)(dst+j), _mm256_min_epi32(_mm256_loadu_si256((const __m256i*)(a+j)), _mm256_loadu_si256((const __m256i*)(b+j))));
+    
+    minTail(dst, a, b, j, len);
+}
+
+__attribute__((target("avx2")))
+void maxRowAVX2(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+8 <= len; j += 8)
+        _mm256_storeu_si256((__m256i*)(dst+j), _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)(a+j)), _mm256_loadu_si256((const __m256i*)(b+j))));
+    
+    maxTail(dst, a, b, j, len);
+}
+
+__attribute__((target("avx2")))
+void weightedSumRowAVX2(double* dst, double** rows, double* weights, int n, int len)
+{
+    int j, k;
+    const double* p;
+    __m256d w, s0, s1, s2, s3;
+    
+    // 16 pixels for iteration, 4 for each accumulator
+    for (j = 0; j+16 <= len; j += 16) {
+        s0 = s1 = s2 = s3 = _mm256_setzero_pd();
+        for (k = 0; k < n; k++) {
+            w = _mm256_set1_pd(weights[k]);
+            p = rows[k]+j;
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(p), w));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(p+4), w));
+            s2 = _mm256_add_pd(s2, _mm256_mul_pd(_mm256_loadu_pd(p+8), w));
+            s3 = _mm256_add_pd(s3, _mm256_mul_pd(_mm256_loadu_pd(p+12), w));
+        }
+        _mm256_storeu_pd(dst+j, s0);
+        _mm256_storeu_pd(dst+j+4, s1);
+        _mm256_storeu_pd(dst+j+8, s2);
+        _mm256_storeu_pd(dst+j+12, s3);
+    }
+    
+    weightedSumTail(dst, rows, weights, n, j, len);
+}
+
+int supportsAVX2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef KERNELS_AVX512
+//---------------------------------------------------------//
+//--------------------- AVX-512 kernels -------------------//
+//---------------------------------------------------------//
+
+__attribute__((target("avx512f")))
+void convolutionRowAVX512(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int* out)
+{
+    int j, k, l, il, ix;
+    int width = pgmIn1->width;
+    int stride = pgmIn1->stride;
+    int* pixels = pgmIn1->pixels;
+    const int* p;
+    __m512d w, s0, s1, s2, s3;
+    
+    // 32 pixels for iteration, 8 for each accumulator
+    for (j = 0; j+32 <= width; j += 32) {
+        s0 = s1 = s2 = s3 = _mm512_setzero_pd();
+        ix = 0;
+        for (k=-spanY, il = ic+j-stride*spanY; k <= spanY; k++, il += stride)
+            for (l=-spanX; l <= spanX; l++) {
+                w = _mm512_set1_pd(kernel[ix++]);
+                p = pixels+il+l;
+                s0 = _mm512_add_pd(s0, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)p)), w));
+                s1 = _mm512_add_pd(s1, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)(p+8))), w));
+                s2 = _mm512_add_pd(s2, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)(p+16))), w));
+                s3 = _mm512_add_pd(s3, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*)(p+24))), w));
+            }
+        _mm256_storeu_si256((__m256i*)(out+j), _mm512_cvttpd_epi32(_mm512_roundscale_pd(s0, _MM_FROUND_TO_NEG_INF)));
+        _mm256_storeu_si256((__m256i*)(out+j+8), _mm512_cvttpd_epi32(_mm512_roundscale_pd(s1, _MM_FROUND_TO_NEG_INF)));
+        _mm256_storeu_si256((__m256i*)(out+j+16), _mm512_cvttpd_epi32(_mm512_roundscale_pd(s2, _MM_FROUND_TO_NEG_INF)));
+        _mm256_storeu_si256((__m256i*)(out+j+24), _mm512_cvttpd_epi32(_mm512_roundscale_pd(s3, _MM_FROUND_TO_NEG_INF)));
+    }
+    
+    convolutionTail(pgmIn1, kernel, spanX, spanY, ic, j, out);
+}
+
+__attribute__((target("avx512f")))
+void gradientRowAVX512(int* top, int* mid, int* bottom, int width, int weight, unsigned int phase, int* out)
+{
+    int j, k;
+    // the weight is a power of 2, the central taps are shifted
+    __m128i shift = _mm_cvtsi32_si128(weight >> 1);
+    __m512i l, c, r, sumT, sumB, vx, vy;
+    __m512d x, y;
+    int ax[16], ay[16];
+    
+    for (j = 0; j+16 <= width; j += 16) {
+        l = _mm512_loadu_si512((const void*)(top+j-1));
+        c = _mm512_loadu_si512((const void*)(top+j));
+        r = _mm512_loadu_si512((const void*)(top+j+1));
+        sumT = _mm512_add_epi32(_mm512_add_epi32(l, r), _mm512_sll_epi32(c, shift));
+        vy = _mm512_sub_epi32(l, r);
+    
+        l = _mm512_loadu_si512((const void*)(mid+j-1));
+        r = _mm512_loadu_si512((const void*)(mid+j+1));
+        vy = _mm512_add_epi32(vy, _mm512_sll_epi32(_mm512_sub_epi32(l, r), shift));
+    
+        l = _mm512_loadu_si512((const void*)(bottom+j-1));
+        c = _mm512_loadu_si512((const void*)(bottom+j));
+        r = _mm512_loadu_si512((const void*)(bottom+j+1));
+        sumB = _mm512_add_epi32(_mm512_add_epi32(l, r), _mm512_sll_epi32(c, shift));
+        vy = _mm512_add_epi32(vy, _mm512_sub_epi32(l, r));
+        vx = _mm512_sub_epi32(sumT, sumB);
+    
+        if (phase == 1) {
+            _mm512_storeu_si512((void*)ax, vx);
+            _mm512_storeu_si512((void*)ay, vy);
+            for (k = 0; k < 16; k++)
+                out[j+k] = (int)(atan2(ay[k], ax[k])*M_1_PI*127);
+        } else {
+            x = _mm512_cvtepi32_pd(_mm512_castsi512_si256(vx));
+            y = _mm512_cvtepi32_pd(_mm512_castsi512_si256(vy));
+            _mm256_storeu_si256((__m256i*)(out+j),
+                                _mm512_cvttpd_epi32(_mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(y, y)))));
+            x = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(vx, 1));
+            y = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(vy, 1));
+            _mm256_storeu_si256((__m256i*)(out+j+8),
+                                _mm512_cvttpd_epi32(_mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(y, y)))));
+        }
+    }
+    
+    gradientTail(top, mid, bottom, j, width, weight, phase, out);
+}
+
+__attribute__((target("avx512f")))
+void rangeRowAVX512(int* pixels, int len, int* min, int* max)
+{
+    int j, k;
+    int lanesMin[16], lanesMax[16];
+    __m512i v;
+    __m512i vmin = _mm512_set1_epi32(*min);
+    __m512i vmax = _mm512_set1_epi32(*max);
+    
+    for (j = 0; j+16 <= len; j += 16) {
+        v = _mm512_loadu_si512((const void*)(pixels+j));
+        vmin = _mm512_min_epi32(vmin, v);
+        vmax = _mm512_max_epi32(vmax, v);
+    }
+    _mm512_storeu_si512((void*)lanesMin, vmin);
+    _mm512_storeu_si512((void*)lanesMax, vmax);
+    for (k = 0; k < 16; k++) {
+        if (lanesMin[k] < *min)
+            *min = lanesMin[k];
+        if (lanesMax[k] > *max)
+            *max = lanesMax[k];
+    }
+    
+    rangeTail(pixels, j, len, min, max);
+}
+
+__attribute__((target("avx512f")))
+void compareRowAVX512(int* a, int* b, int len)
+{
+    int j;
+    __m512i va, vb;
+    
+    for (j = 0; j+16 <= len; j += 16) {
+        va = _mm512_loadu_si512((const void*)(a+j));
+        vb = _mm512_loadu_si512((const void*)(b+j));
+        _mm512_storeu_si512((void*)(a+j), _mm512_min_epi32(va, vb));
+        _mm512_storeu_si512((void*)(b+j), _mm512_max_epi32(va, vb));
+    }
+    
+    compareTail(a, b, j, len);
+}
+
+__attribute__((target("avx512f")))
+void minRowAVX512(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+16 <= len; j += 16)
+        _mm512_storeu_si512((void*)(dst+j), _mm512_min_epi32(_mm512_loadu_si512((const void*)(a+j)), _mm512_loadu_si512((const void*)(b+j))));
+    
+    minTail(dst, a, b, j, len);
+}
+
+__attribute__((target("avx512f")))
+void maxRowAVX512(int* dst, int* a, int* b, int len)
+{
+    int j;
+    
+    for (j = 0; j+16 <= len; j += 16)
+        _mm512_storeu_si512((void*)(dst+j), _mm512_max_epi32(_mm512_loadu_si512((const void*)(a+j)), _mm512_loadu_si512((const void*)(b+j))));
+    
+    maxTail(dst, a, b, j, len);
+}
+
+__attribute__((target("avx512f")))
+void weightedSumRowAVX512(double* dst, double** rows, double* weights, int n, int len)
+{
+    int j, k;
+    const double* p;
+    __m512d w, s0, s1, s2, s3;
+    
+    // 32 pixels for iteration, 8 for each accumulator
+    for (j = 0; j+32 <= len; j += 32) {
+        s0 = s1 = s2 = s3 = _mm512_setzero_pd();
+        for (k = 0; k < n; k++) {
+            w = _mm512_set1_pd(weights[k]);
+            p = rows[k]+j;
+            s0 = _mm512_add_pd(s0, _mm512_mul_pd(_mm512_loadu_pd(p), w));
+            s1 = _mm512_add_pd(s1, _mm512_mul_pd(_mm512_loadu_pd(p+8), w));
+            s2 = _mm512_add_pd(s2, _mm512_mul_pd(_mm512_loadu_pd(p+16), w));
+            s3 = _mm512_add_pd(s3, _mm512_mul_pd(_mm512_loadu_pd(p+24), w));
+        }
+        _mm512_storeu_pd(dst+j, s0);
+        _mm512_storeu_pd(dst+j+8, s1);
+        _mm512_storeu_pd(dst+j+16, s2);
+        _mm512_storeu_pd(dst+j+24, s3);
+    }
+    
+    weightedSumTail(dst, rows, weights, n, j, len);
+}
+
+int supportsAVX512(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+//---------------------------------------------------------//
+//------------------------ Dispatch -----------------------//
+//---------------------------------------------------------//
+
+// The kernel sets from the fastest to the slowest
+const static KernelSet kernelSets[] = {
+#ifdef KERNELS_AVX512
+    {"avx512", supportsAVX512, convolutionRowAVX512, gradientRowAVX512, rangeRowAVX512,
+     compareRowAVX512, minRowAVX512, maxRowAVX512, weightedSumRowAVX512},
+#endif
+#ifdef KERNELS_X86
+    {"avx2", supportsAVX2, convolutionRowAVX2, gradientRowAVX2, rangeRowAVX2,
+     compareRowAVX2, minRowAVX2, maxRowAVX2, weightedSumRowAVX2},
+    {"sse4.2", supportsSSE42, convolutionRowSSE42, gradientRowSSE42, rangeRowSSE42,
+     compareRowSSE42, minRowSSE42, maxRowSSE42, weightedSumRowSSE42},
+#endif
+    {"scalar", supportsScalar, convolutionRowScalar, gradientRowScalar, rangeRowScalar,
+     compareRowScalar, minRowScalar, maxRowScalar, weightedSumRowScalar}
+};
+
+// The kernel set in use, NULL until one is selected
+const KernelSet* kernelSet = NULL;
+
+/*! \fn int selectKernelsPGM(const char* name)
+ * \brief Select the instruction set of the kernels.
+ *
+ * The names are avx512, avx2, sse4.2 and scalar. With \a name NULL or "auto" the fastest
+ * instruction set supported by the CPU is selected.
+ * \param name The name of the instruction set.
+ * \return 0 on success, -1 if the instruction set is unknown or not supported by the CPU.
+ */
+int selectKernelsPGM(const char* name)
+{
+    int i;
+    int nSets = sizeof(kernelSets)/sizeof(kernelSets[0]);
+    int automatic = name == NULL || strcmp(name, "auto") == 0;
+    
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+#endif
+    
+    for (i = 0; i < nSets; i++) {
+        if (!automatic && strcmp(name, kernelSets[i].name) != 0)
+            continue;
+    
+        if (!kernelSets[i].supported()) {
+            if (automatic)
+                continue;
+            fprintf(stderr, "Error! The CPU does not support the %s instruction set. Please Check.\n", name);
+            return -1;
+        }
+    
+        kernelSet = &kernelSets[i];
+        return 0;
+    }
+    
+    fprintf(stderr, "Error! Unknown instruction set %s. Please Check.\n", name);
+    return -1;
+}
+
+/*! \fn const KernelSet* kernelsPGM(void)
+ * \brief Return the kernel set in use.
+ *
+ * If none was selected with selectKernelsPGM() the instruction set is read from the environment
+ * variable KERNELS_ENV or, if it is not set or not valid, the fastest one is used.
+ * \return Pointer to the kernel set.
+ */
+const KernelSet* kernelsPGM(void)
+{
+    if (kernelSet == NULL && selectKernelsPGM(getenv(KERNELS_ENV)) < 0)
+        selectKernelsPGM(NULL);
+    
+    return kernelSet;
+}
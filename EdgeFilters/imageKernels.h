@@ -0,0 +1,49 @@
+/*! \file imageKernels.h
+ *  \brief Interfaces to the row kernels compiled for several instruction sets and selected at run time.
+ *  \author Gianluca Gerard
+ *  \copyright Apache License Version 2.0, January 2004
+ */
+
+#ifndef imageKernels_h
+#define imageKernels_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imageUtilities.h"
+
+/*! \def KERNELS_ENV
+ * \brief Environment variable with the name of the instruction set of the kernels (auto if not set).
+ */
+#define KERNELS_ENV "FILTERPGM_ISA"
+
+/*! \struct KernelSet
+ * \brief The row kernels compiled for an instruction set.
+ *
+ * All the kernel sets compute exactly the same results.
+ */
+typedef struct
+{
+    const char* name;         /*!< Name of the instruction set */
+    int (*supported)(void);   /*!< Return 1 if the CPU supports the instruction set */
+    void (*convolutionRow)(Pgm* pgmIn1, double* kernel, int spanX, int spanY, int ic, int* out);
+                              /*!< Convolution of a row of a strip (see stripApplyPGM()) */
+    void (*gradientRow)(int* top, int* mid, int* bottom, int width, int weight, unsigned int phase, int* out);
+                              /*!< Sobel or Prewitt gradient of a row (see gradientPGM()) */
+    void (*rangeRow)(int* pixels, int len, int* min, int* max);
+                              /*!< Update the minimum and the maximum with the values of a row */
+    void (*compareRow)(int* a, int* b, int len);
+                              /*!< Compare and exchange two rows, leaving the minima in a and the maxima in b */
+    void (*minRow)(int* dst, int* a, int* b, int len);
+                              /*!< Store the minima of two rows in dst, that can be one of them */
+    void (*maxRow)(int* dst, int* a, int* b, int len);
+                              /*!< Store the maxima of two rows in dst, that can be one of them */
+    void (*weightedSumRow)(double* dst, double** rows, double* weights, int n, int len);
+                              /*!< Store in dst the sum of n rows times their weights */
+} KernelSet;
+
+int selectKernelsPGM(const char* name);
+const KernelSet* kernelsPGM(void);
+
+#endif /* imageKernels_h */
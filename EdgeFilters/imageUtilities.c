@@ -6,63 +6,320 @@
  */
  
 #include "imageUtilities.h"
+#include "imageKernels.h"
 
 //******************* I/O FUNCTIONS *********************//
 
-/*! \fn int skipComments(char* buf, FILE* fp)
- * \brief Skip commented lines.
- * \param buf Pointer to the buffer where the file lines are stored.
- * \param fp Pointer to the image file.
- * \return Always 0
+/*! \fn const unsigned char* readHeaderValue(const unsigned char* p, const unsigned char* end, int* value)
+ * \brief Read a decimal value from a PGM header skipping white spaces and commented lines.
+ * \param p Pointer to the first header character still to be parsed.
+ * \param end Pointer past the last character of the file.
+ * \param value Pointer to the integer where the value is stored.
+ * \return Pointer to the character following the value or NULL if no value could be read or it exceeds INT_MAX.
  */
-int skipComments(char* buf, FILE* fp)
+const unsigned char* readHeaderValue(const unsigned char* p, const unsigned char* end, int* value)
+{
+	int val = 0;
+	
+	// Jump white spaces and commented lines
+	while(p < end)
+	{
+		if(*p == '#')
+		{
+			while(p < end && *p != '\n')
+				p++;
+		}
+		else if(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+			p++;
+		else
+			break;
+	}
+	
+	if(p == end || *p < '0' || *p > '9')
+		return NULL;
+	
+	while(p < end && *p >= '0' && *p <= '9')
+	{
+		if(val > (INT_MAX - (*p - '0'))/10)
+			return NULL;
+		val = val*10 + (*p - '0');
+		p++;
+	}
+	*value = val;
+	
+	return p;
+}
+
+/*! \fn void copySamples(const unsigned char* raster, Pgm* pgm, int row)
+ * \brief Copy a row of P5 samples in the pixels array of \a pgm.
+ *
+ * Images of format PGM_U8 receive a plain copy of the raster. For images of format PGM_U16 the
+ * samples are two bytes wide and stored most significant byte first as required by the PGM format.
+ * \param raster Pointer to the first sample of the row.
+ * \param pgm Pointer to the Pgm structure receiving the samples.
+ * \param row The image row.
+ */
+void copySamples(const unsigned char* raster, Pgm* pgm, int row)
+{
+	int i = 0;
+	int len = pgm->width;
+	size_t offset = (size_t)row*pgm->stride;
+	
+	if(pgm->format == PGM_U8)
+	{
+		memcpy((unsigned char*)pgm->pixels + offset, raster, len);
+	}
+	else
+	{
+		unsigned short* pixels = (unsigned short*)pgm->pixels + offset;
+#ifdef __SSE2__
+		for(; i+8 <= len; i += 8)
+		{
+			// swap the two bytes of each big-endian sample
+			__m128i v = _mm_loadu_si128((const __m128i*)(raster+2*i));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			_mm_storeu_si128((__m128i*)(pixels+i), v);
+		}
+#endif
+		for(; i<len; i++)
+			pixels[i] = (unsigned short)((raster[2*i] << 8) | raster[2*i+1]);
+	}
+}
+
+/*! \fn int readTextSamples(const unsigned char** pp, const unsigned char* end, int* pixels, int len)
+ * \brief Parse the decimal samples of a P2 raster.
+ *
+ * Samples are separated by white spaces and may have a sign. Commented lines are skipped.
+ * Samples beyond the range of int saturate to INT_MAX or -INT_MAX.
+ * \param pp Pointer to the pointer to the next character of the raster, advanced past the samples read.
+ * \param end Pointer past the last character of the file.
+ * \param pixels Pointer to the array where the pixels values are stored.
+ * \param len Number of samples to read.
+ * \return The number of samples actually read.
+ */
+int readTextSamples(const unsigned char** pp, const unsigned char* end, int* pixels, int len)
 {
 	int i;
-	int loop = 1;
-	while(buf[0]=='#')
+	int val, neg;
+	const unsigned char* p = *pp;
+	
+	for(i=0; i<len; i++)
 	{
-		loop = 1;
-		for(i=1; i<64; i++)
+		// Jump white spaces and commented lines
+		while(p < end && (*p <= ' ' || *p == '#'))
 		{
-			if(buf[i] == '\n')
-				loop = 0;
+			if(*p == '#')
+				while(p < end && *p != '\n')
+					p++;
+			else
+				p++;
 		}
-		while(loop)
+		if(p == end)
+			break;
+		
+		neg = 0;
+		if(*p == '-' || *p == '+')
 		{
-			fgets(buf,2,fp);
-			if(buf[0] == '\n')
-				loop = 0;
+			neg = (*p == '-');
+			p++;
 		}
-		fgets(buf, 64, fp);
+		
+		val = 0;
+		while(p < end && (unsigned)(*p - '0') < 10)
+		{
+			// Saturate at INT_MAX, as readHeaderValue() guards against it
+			if(val > (INT_MAX - (*p - '0'))/10)
+				val = INT_MAX;
+			else
+				val = val*10 + (*p - '0');
+			p++;
+		}
+		// Skip anything else up to the next separator as atoi() did
+		while(p < end && *p > ' ')
+			p++;
+		
+		pixels[i] = neg ? -val : val;
 	}
-    return 0;
+	
+	*pp = p;
+	return i;
 }
 
-/*! \fn Pgm* newPGM(int width, int height, int max_val)
- * \brief Create a new empty pgm image.
+// Size in bytes of a pixel for each PgmFormat
+const static int sampleSize[] = {1, 2, 2, 4, 4};
+
+// The scratch arena: buffers released by the images are kept here, up to ARENA_SLOTS,
+// and handed out again to the next request of the same size
+typedef struct
+{
+	size_t bytes;
+	void* buffer;
+} ArenaSlot;
+
+ArenaSlot arena[ARENA_SLOTS];
+int arenaUsed = 0;
+int arenaHugePages = 0;
+
+/*! \fn void* getBufferPGM(size_t bytes)
+ * \brief Return a buffer of \a bytes bytes aligned to ROW_ALIGN from the scratch arena.
+ *
+ * A buffer of the same size released with putBufferPGM() is reused when available, otherwise
+ * a new one is allocated. When huge pages are enabled buffers of at least HUGE_PAGE_BYTES are
+ * aligned to a huge page and the kernel is advised to back them with huge pages.
+ * The content of the buffer is undefined.
+ * \param bytes The size of the buffer.
+ * \return Pointer to the buffer or NULL if the memory is exhausted.
+ */
+void* getBufferPGM(size_t bytes)
+{
+	int i;
+	void* buffer = NULL;
+	size_t align = ROW_ALIGN;
+	
+	for(i=0; i<arenaUsed; i++)
+	{
+		if(arena[i].bytes == bytes)
+		{
+			buffer = arena[i].buffer;
+			arena[i] = arena[--arenaUsed];
+			return buffer;
+		}
+	}
+	
+	if(arenaHugePages && bytes >= HUGE_PAGE_BYTES)
+		align = HUGE_PAGE_BYTES;
+	if(posix_memalign(&buffer, align, bytes) != 0)
+	{
+		fprintf(stderr, "Error! Out of memory. Please Check.\n");
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if(align == HUGE_PAGE_BYTES)
+		madvise(buffer, bytes, MADV_HUGEPAGE);
+#endif
+	
+	return buffer;
+}
+
+/*! \fn void putBufferPGM(void* buffer, size_t bytes)
+ * \brief Release to the scratch arena a buffer obtained with getBufferPGM().
+ *
+ * If the arena is full the oldest buffer is freed to make room.
+ * \param buffer Pointer to the buffer. Nothing is done if it is NULL.
+ * \param bytes The size of the buffer.
+ */
+void putBufferPGM(void* buffer, size_t bytes)
+{
+	if(!buffer)
+		return;
+	
+	if(arenaUsed == ARENA_SLOTS)
+	{
+		free(arena[0].buffer);
+		memmove(arena, arena+1, (ARENA_SLOTS-1)*sizeof(ArenaSlot));
+		arenaUsed--;
+	}
+	arena[arenaUsed].bytes = bytes;
+	arena[arenaUsed].buffer = buffer;
+	arenaUsed++;
+}
+
+/*! \fn void clearBuffersPGM(void)
+ * \brief Free all the buffers kept in the scratch arena.
+ */
+void clearBuffersPGM(void)
+{
+	while(arenaUsed > 0)
+		free(arena[--arenaUsed].buffer);
+}
+
+/*! \fn void hugePagesPGM(int enable)
+ * \brief Enable or disable huge pages for the buffers allocated from now on by the scratch arena.
+ * \param enable 1 to enable huge pages, 0 to disable them.
+ */
+void hugePagesPGM(int enable)
+{
+	arenaHugePages = enable;
+}
+
+/*! \fn void* allocPixels(Pgm* pgm)
+ * \brief Set the row stride of \a pgm for its width and format and get a pixels array for it from the scratch arena.
+ *
+ * Each row starts at a multiple of ROW_ALIGN bytes. The content of the array is undefined.
+ * \param pgm Pointer to a Pgm structure.
+ * \return Pointer to the pixels array.
+ */
+void* allocPixels(Pgm* pgm)
+{
+	int size = sampleSize[pgm->format];
+	
+	pgm->stride = (int)(((size_t)pgm->width*size + ROW_ALIGN-1)/ROW_ALIGN*ROW_ALIGN/size);
+	
+	return getBufferPGM(bytesPGM(pgm));
+}
+
+/*! \fn Pgm* scratchPGM(int width, int height, int max_val, PgmFormat format)
+ * \brief Create a new pgm image with undefined pixels values.
+ *
+ * The pixels array comes from the scratch arena, so images for temporary results
+ * reuse the memory of the images freed before them.
  * \param width Image's width.
  * \param height Image's height.
  * \param max_val Maximum pixel value in the image.
+ * \param format Storage format of the pixels.
  * \return Pointer to the new created image.
  */
-Pgm* newPGM(int width, int height, int max_val)
-{	
+Pgm* scratchPGM(int width, int height, int max_val, PgmFormat format)
+{
 	Pgm* newPgm = (Pgm*)malloc(1*sizeof(Pgm));
 	newPgm->width = width;
 	newPgm->height = height;
 	newPgm->max_val = max_val;
-	newPgm->pixels = (int*) calloc(width*height, sizeof(int));	
+	newPgm->format = format;
+	newPgm->pixels = allocPixels(newPgm);
+	
+	return newPgm;
+}
+
+/*! \fn Pgm* newFormatPGM(int width, int height, int max_val, PgmFormat format)
+ * \brief Create a new empty pgm image storing its pixels with the given format.
+ * \param width Image's width.
+ * \param height Image's height.
+ * \param max_val Maximum pixel value in the image.
+ * \param format Storage format of the pixels.
+ * \return Pointer to the new created image.
+ */
+Pgm* newFormatPGM(int width, int height, int max_val, PgmFormat format)
+{
+	Pgm* newPgm = scratchPGM(width, height, max_val, format);
+	memset(newPgm->pixels, 0, bytesPGM(newPgm));
 	
 	return newPgm;
 }
 
+/*! \fn Pgm* newPGM(int width, int height, int max_val)
+ * \brief Create a new empty pgm image.
+ *
+ * The pixels are stored as signed integers, wide enough for any intermediate result.
+ * \param width Image's width.
+ * \param height Image's height.
+ * \param max_val Maximum pixel value in the image.
+ * \return Pointer to the new created image.
+ */
+Pgm* newPGM(int width, int height, int max_val)
+{	
+	return newFormatPGM(width, height, max_val, PGM_S32);
+}
+
 /*! \fn void freePGM(Pgm** pgm)
  * \brief Free Pgm structure.
+ *
+ * The pixels array is released to the scratch arena.
  * \param pgm Pointer to a Pgm structure pointer.
  */
 void freePGM(Pgm** pgm)
 {
-	free((*pgm)->pixels);
+	putBufferPGM((*pgm)->pixels, bytesPGM(*pgm));
 	(*pgm)->pixels = NULL;
 	free(*pgm);
 	*pgm = NULL;
@@ -74,105 +331,495 @@ void freePGM(Pgm** pgm)
  */
 void resetPGM(Pgm* pgm)
 {
-	int width = pgm->width;
-	int height = pgm->height;
-	int i;
-	 
 	// set to zero all the pixels
-	for(i=0; i<width*height; i++)
+	memset(pgm->pixels, 0, bytesPGM(pgm));
+}
+
+/*! \fn size_t bytesPGM(Pgm* pgm)
+ * \brief Return the size in bytes of the pixels array of \a pgm.
+ * \param pgm Pointer to a Pgm structure.
+ */
+size_t bytesPGM(Pgm* pgm)
+{
+	return (size_t)pgm->stride*pgm->height*sampleSize[pgm->format];
+}
+
+/*! \fn PgmFormat fitFormatPGM(double min, double max)
+ * \brief Return the narrowest integer storage format able to store all values in [\a min, \a max].
+ * \param min The minimum value to store.
+ * \param max The maximum value to store.
+ */
+PgmFormat fitFormatPGM(double min, double max)
+{
+	if(min >= 0 && max <= 255)
+		return PGM_U8;
+	if(min >= 0 && max <= 65535)
+		return PGM_U16;
+	if(min >= -32768 && max <= 32767)
+		return PGM_S16;
+	return PGM_S32;
+}
+
+/*! \fn void rangeFormatPGM(PgmFormat format, double* min, double* max)
+ * \brief Return in \a min and \a max the interval of values that can be stored with \a format.
+ * \param format The storage format.
+ * \param min Pointer to the minimum value.
+ * \param max Pointer to the maximum value.
+ */
+void rangeFormatPGM(PgmFormat format, double* min, double* max)
+{
+	switch(format)
+	{
+		case PGM_U8:
+			*min = 0;
+			*max = 255;
+			break;
+		case PGM_U16:
+			*min = 0;
+			*max = 65535;
+			break;
+		case PGM_S16:
+			*min = -32768;
+			*max = 32767;
+			break;
+		default:
+			*min = -2147483648.0;
+			*max = 2147483647.0;
+	}
+}
+
+/*! \fn void rangePGM(Pgm* pgm, int* min, int* max)
+ * \brief Return in \a min and \a max the smallest and the largest pixel values of the image.
+ * \param pgm Pointer to the Pgm structure with the image.
+ * \param min Pointer to the minimum value.
+ * \param max Pointer to the maximum value.
+ */
+void rangePGM(Pgm* pgm, int* min, int* max)
+{
+	int i;
+	int* pixels = (int*)malloc(pgm->width*sizeof(int));
+	const KernelSet* kernels = kernelsPGM();
+
+	*min = INT_MAX;
+	*max = INT_MIN;
+	for(i=0; i<pgm->height; i++)
 	{
-		pgm->pixels[i] = 0;
+		getRowPGM(pgm, i, 0, pgm->width, pixels);
+		kernels->rangeRow(pixels, pgm->width, min, max);
 	}
+
+	free(pixels);
+}
+
+/*! \fn void getRowPGM(Pgm* pgm, int row, int col, int len, int* buf)
+ * \brief Copy \a len pixels of \a pgm, starting at (\a row, \a col), in the integer array \a buf.
+ * \param pgm Pointer to a Pgm structure.
+ * \param row The row of the first pixel.
+ * \param col The column of the first pixel.
+ * \param len The number of pixels to copy.
+ * \param buf Pointer to the array receiving the pixels values.
+ */
+void getRowPGM(Pgm* pgm, int row, int col, int len, int* buf)
+{
+	int i;
+	size_t offset = (size_t)row*pgm->stride + col;
+	
+	switch(pgm->format)
+	{
+		case PGM_U8:
+		{
+			const unsigned char* src = (unsigned char*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+				buf[i] = src[i];
+			break;
+		}
+		case PGM_U16:
+		{
+			const unsigned short* src = (unsigned short*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+				buf[i] = src[i];
+			break;
+		}
+		case PGM_S16:
+		{
+			const short* src = (short*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+				buf[i] = src[i];
+			break;
+		}
+		case PGM_F32:
+		{
+			const float* src = (float*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+				buf[i] = (int)floorf(src[i]);
+			break;
+		}
+		default:
+			memcpy(buf, (int*)pgm->pixels + offset, len*sizeof(int));
+	}
+}
+
+/*! \fn void setRowPGM(Pgm* pgm, int row, int col, int len, int* buf)
+ * \brief Store the \a len values of \a buf in \a pgm, starting at (\a row, \a col).
+ *
+ * Values not representable in the storage format of \a pgm are saturated.
+ * \param pgm Pointer to a Pgm structure.
+ * \param row The row of the first pixel.
+ * \param col The column of the first pixel.
+ * \param len The number of pixels to store.
+ * \param buf Pointer to the array with the pixels values.
+ */
+void setRowPGM(Pgm* pgm, int row, int col, int len, int* buf)
+{
+	int i, v;
+	size_t offset = (size_t)row*pgm->stride + col;
+	
+	switch(pgm->format)
+	{
+		case PGM_U8:
+		{
+			unsigned char* dst = (unsigned char*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+			{
+				v = buf[i];
+				dst[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+			}
+			break;
+		}
+		case PGM_U16:
+		{
+			unsigned short* dst = (unsigned short*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+			{
+				v = buf[i];
+				dst[i] = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+			}
+			break;
+		}
+		case PGM_S16:
+		{
+			short* dst = (short*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+			{
+				v = buf[i];
+				dst[i] = v < -32768 ? -32768 : (v > 32767 ? 32767 : v);
+			}
+			break;
+		}
+		case PGM_F32:
+		{
+			float* dst = (float*)pgm->pixels + offset;
+			for(i=0; i<len; i++)
+				dst[i] = (float)buf[i];
+			break;
+		}
+		default:
+			memcpy((int*)pgm->pixels + offset, buf, len*sizeof(int));
+	}
+}
+
+/*! \fn int formatPGM(Pgm* pgm, PgmFormat format)
+ * \brief Change the storage format of the pixels of \a pgm.
+ *
+ * The pixels values are preserved when representable in the new format, saturated otherwise.
+ * \param pgm Pointer to a Pgm structure.
+ * \param format The new storage format.
+ * \return 0 on success. -1 if no Pgm structure pointer is provided.
+ */
+int formatPGM(Pgm* pgm, PgmFormat format)
+{
+	int row;
+	
+	if(!pgm)
+	{
+		fprintf(stderr, "Error! No input data. Please Check.\n");
+		return -1;
+	}
+	
+	if(pgm->format == format)
+		return 0;
+	
+	Pgm converted = *pgm;
+	converted.format = format;
+	converted.pixels = allocPixels(&converted);
+	
+	int* buf = (int*)malloc(pgm->width*sizeof(int));
+	for(row=0; row<pgm->height; row++)
+	{
+		getRowPGM(pgm, row, 0, pgm->width, buf);
+		setRowPGM(&converted, row, 0, pgm->width, buf);
+	}
+	free(buf);
+	
+	putBufferPGM(pgm->pixels, bytesPGM(pgm));
+	pgm->pixels = converted.pixels;
+	pgm->format = format;
+	pgm->stride = converted.stride;
+	
+	return 0;
+}
+
+/*! \fn int reformatPGM(Pgm* pgm, PgmFormat format)
+ * \brief Change the storage format of the pixels of \a pgm discarding their values.
+ *
+ * To be used on images that are going to be completely overwritten.
+ * \param pgm Pointer to a Pgm structure.
+ * \param format The new storage format.
+ * \return 0 on success. -1 if no Pgm structure pointer is provided.
+ */
+int reformatPGM(Pgm* pgm, PgmFormat format)
+{
+	if(!pgm)
+	{
+		fprintf(stderr, "Error! No input data. Please Check.\n");
+		return -1;
+	}
+	
+	if(pgm->format == format)
+		return 0;
+	
+	putBufferPGM(pgm->pixels, bytesPGM(pgm));
+	pgm->format = format;
+	pgm->pixels = allocPixels(pgm);
+	
+	return 0;
+}
+
+/*! \fn void swapPGM(Pgm* pgm1, Pgm* pgm2)
+ * \brief Exchange the content of two images without copying their pixels.
+ * \param pgm1 Pointer to the first Pgm structure.
+ * \param pgm2 Pointer to the second Pgm structure.
+ */
+void swapPGM(Pgm* pgm1, Pgm* pgm2)
+{
+	Pgm tmp = *pgm1;
+	*pgm1 = *pgm2;
+	*pgm2 = tmp;
+}
+
+/*! \fn Pgm* targetPGM(Pgm* pgmOut, PgmFormat format, int inPlace)
+ * \brief Return the image where a row by row operation writes the result to be stored in \a pgmOut.
+ *
+ * Operations that read each row before writing it can work in place, that is with \a pgmOut
+ * also being an input, as long as the storage format does not change. Otherwise the result
+ * is written in a scratch image that storePGM() moves to \a pgmOut.
+ * \param pgmOut Pointer to the output Pgm structure.
+ * \param format The storage format of the result.
+ * \param inPlace 1 if \a pgmOut is also an input of the operation.
+ * \return Pointer to the image where the result must be written.
+ */
+Pgm* targetPGM(Pgm* pgmOut, PgmFormat format, int inPlace)
+{
+	if(inPlace && pgmOut->format != format)
+		return scratchPGM(pgmOut->width, pgmOut->height, pgmOut->max_val, format);
+	
+	reformatPGM(pgmOut, format);
+	return pgmOut;
+}
+
+/*! \fn void storePGM(Pgm* target, Pgm* pgmOut)
+ * \brief Move to \a pgmOut the pixels of the result written in the image returned by targetPGM().
+ * \param target Pointer to the image returned by targetPGM().
+ * \param pgmOut Pointer to the output Pgm structure.
+ */
+void storePGM(Pgm* target, Pgm* pgmOut)
+{
+	if(target == pgmOut)
+		return;
+	
+	target->max_val = pgmOut->max_val;
+	swapPGM(target, pgmOut);
+	freePGM(&target);
 }
 
 /*! \fn Pgm* readPGM(char* filename)
  * \brief Read Pixels From Different FileType.
+ *
+ * The file is memory mapped and its header parsed in place. P5 samples are then converted
+ * in a single pass from the mapped raster, while P2 samples are parsed straight from the mapped text.
  * \param filename Name of the file with the image.
  * \return Pointer to the Pgm structure containing the read image.
  */
 Pgm* readPGM(char* filename)
 {
 	int binary, width, height, max_val;
-	FILE *fp = fopen(filename, "rb");
+	struct stat st;
 	Pgm* pgm;
 	
-	if(fp == NULL)
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0)
 	{
 		fprintf(stderr, "File not found. Please Check.\n");
 		return NULL;
 	}
-
-	char buffer[64];
-	// Read a line till \n or 64 char
-	fgets(buffer, 64, fp);
-     	
-     if(strcmp(buffer,"P2\n")==0) 
-     {
-	   binary = 0;
-	   printf ("\nFORMAT: P2\n");
-     }
-     else if (strcmp(buffer,"P5\n")==0) 
-     {
-	   binary = 1;
-	   printf ("\nFORMAT: P5\n");
-     }
-     else 
-     {
-	   fprintf (stderr, "ERROR: incorrect file format\n\n");
-	   fclose (fp);
-	   return NULL;
-     } 
-		
-	// Getting Information about the file
-	fgets(buffer, 64, fp);
-
-	// Jump commented lines
-	skipComments(buffer,fp);
-
+	
+	if(fstat(fd, &st) < 0 || st.st_size < 3)
+	{
+		fprintf (stderr, "ERROR: incorrect file format\n\n");
+		close(fd);
+		return NULL;
+	}
+	
+	size_t size = (size_t)st.st_size;
+	unsigned char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if(map == MAP_FAILED)
+	{
+		fprintf(stderr, "Error! Cannot map \"%s\". Please Check.\n", filename);
+		return NULL;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	
+	const unsigned char* end = map + size;
+	const unsigned char* p = map;
+	
+	if(p[0] == 'P' && p[1] == '2')
+	{
+		binary = 0;
+		printf ("\nFORMAT: P2\n");
+	}
+	else if(p[0] == 'P' && p[1] == '5')
+	{
+		binary = 1;
+		printf ("\nFORMAT: P5\n");
+	}
+	else
+	{
+		fprintf (stderr, "ERROR: incorrect file format\n\n");
+		munmap(map, size);
+		return NULL;
+	}
+	p += 2;
+	
 	// Read width, height and max grayscale value
-     sscanf(buffer, "%d %d", &width, &height);
-     fgets(buffer, 64, fp);
-     sscanf(buffer, "%d", &max_val);
+	if((p = readHeaderValue(p, end, &width)) == NULL ||
+	   (p = readHeaderValue(p, end, &height)) == NULL ||
+	   (p = readHeaderValue(p, end, &max_val)) == NULL ||
+	   p == end || width < 1 || height < 1 || max_val < 1 || max_val > 65535)
+	{
+		fprintf (stderr, "ERROR: incorrect file header\n\n");
+		munmap(map, size);
+		return NULL;
+	}
+	// A single white space separates the header from the raster
+	p++;
 
 	// Printing information on screen
 	printf("\nPGM Filename: %s\nPGM Width & Height: %d, %d\nPGM Max Val & Type: %d, %s\n", 
 		   filename, width, height, max_val, binary ? "P5" : "P2");
 	
-	// Inizialize pgm
-	pgm = newPGM(width, height, max_val);
-
+	// Each sample takes at least a character of the file, so larger sizes are not allocated
+	if((size_t)(end - p) < (size_t)width*height)
+	{
+		fprintf (stderr, "ERROR: image larger than the file\n\n");
+		munmap(map, size);
+		return NULL;
+	}
+	
+	int bytes = max_val < 256 ? 1 : 2;
+	if(binary && (size_t)(end - p) < (size_t)width*height*bytes)
+	{
+		fprintf (stderr, "ERROR: truncated raster\n\n");
+		munmap(map, size);
+		return NULL;
+	}
+	
 	// Reading Pixels
-	int i;
 	if(binary) // P5 case
 	{
-		for(i=0; i<pgm->width*pgm->height; i++)
-		{
-			fread(&pgm->pixels[i], sizeof(unsigned char), 1, fp);
-		}
-
+		// Inizialize pgm with samples as wide as the file ones
+		int i;
+		pgm = newFormatPGM(width, height, max_val, bytes == 1 ? PGM_U8 : PGM_U16);
+		for(i=0; i<height; i++)
+			copySamples(p + (size_t)i*width*bytes, pgm, i);
+		munmap(map, size);
 	}
 	else // P2 case
-	{		
-		for(i=0; i<pgm->width*pgm->height; i++)
-		{
-			fscanf(fp, "%s", buffer);
-			pgm->pixels[i] = atoi(buffer);
-		}
+	{
+		int i;
+		int min, max;
+		int read = 0;
+		
+		// Text samples are not bound to max_val, so they are parsed at full precision
+		pgm = newPGM(width, height, max_val);
+		for(i=0; i<height; i++)
+			read += readTextSamples(&p, end, (int*)pgm->pixels + (size_t)i*pgm->stride, width);
+		if(read < width*height)
+			fprintf(stderr, "Warning! Only %d of %d pixels found in \"%s\".\n", read, width*height, filename);
+		munmap(map, size);
+		
+		// Then they are stored in the narrowest format that fits them
+		rangePGM(pgm, &min, &max);
+		if(min >= 0 && max <= max_val)
+			formatPGM(pgm, bytes == 1 ? PGM_U8 : PGM_U16);
 	}
 	
-	// Ok close the file
-	fclose(fp);
-	
 	printf("\nImage \"%s\" correctly loaded.\n", filename);
 	
 	return pgm;
 }
 
+// Two decimal digits for each value in [0, 99]
+const static char digitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/*! \fn char* formatSample(char* buf, int value)
+ * \brief Write \a value in decimal followed by a space, as printf("%d ") would.
+ * \param buf Pointer to a buffer with room for at least 12 characters.
+ * \param value The value to format.
+ * \return Pointer past the last character written.
+ */
+char* formatSample(char* buf, int value)
+{
+	char tmp[10];
+	char* t = tmp + sizeof(tmp);
+	unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	
+	// Produce the digits two at a time from the least significant ones
+	while(u >= 100)
+	{
+		unsigned int r = u % 100;
+		u /= 100;
+		t -= 2;
+		t[0] = digitPairs[2*r];
+		t[1] = digitPairs[2*r+1];
+	}
+	if(u >= 10)
+	{
+		t -= 2;
+		t[0] = digitPairs[2*u];
+		t[1] = digitPairs[2*u+1];
+	}
+	else
+		*--t = (char)('0' + u);
+	
+	if(value < 0)
+		*buf++ = '-';
+	memcpy(buf, t, tmp + sizeof(tmp) - t);
+	buf += tmp + sizeof(tmp) - t;
+	*buf++ = ' ';
+	
+	return buf;
+}
+
 /*! \fn int writePGM(Pgm* pgm, char* filename)
  * \brief Write Pixels inside images for Different FileType.
+ *
+ * The image is written in PGM P2 (ASCII) format. The text is composed in a large buffer which
+ * is flushed to the file only when full.
  * \param pgm Pointer to the Pgm structure with the image.
  * \param filename Name of the file where the image is written.
- * \return 0 on success. -1 if no Pgm structure pointer is provided.
+ * \return 0 on success. -1 if no Pgm structure pointer is provided or the file cannot be written.
  */
 int writePGM(Pgm* pgm, char* filename)
 {
@@ -183,25 +830,137 @@ int writePGM(Pgm* pgm, char* filename)
 	}
 	
 	FILE *fp = fopen(filename, "w");
+	if(fp == NULL)
+	{
+		fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+		return -1;
+	}
 	fprintf(fp, "P2\n%d %d\n%d\n", pgm->width, pgm->height, pgm->max_val);
 	
 	int i,j;
-    int l=0;
 	int width = pgm->width;
 	int height = pgm->height;
+	int* pixels = (int*)malloc(width*sizeof(int));
+	
+	// Each sample takes at most 12 characters
+	const int bufSize = 1 << 16;
+	char* buf = (char*)malloc(bufSize);
+	char* b = buf;
 	
 	// Write image
-    for(i=0; i<height; i++) {
-        for (j=0; j<width; j++) {
-            fprintf(fp, "%d ", pgm->pixels[l++]);
-        }
-        fprintf(fp, "\n");
+	for(i=0; i<height; i++) {
+		getRowPGM(pgm, i, 0, width, pixels);
+		for (j=0; j<width; j++) {
+			if(b - buf > bufSize - 13) {
+				fwrite(buf, 1, b - buf, fp);
+				b = buf;
+			}
+			b = formatSample(b, pixels[j]);
+		}
+		*b++ = '\n';
 	}
-
+	fwrite(buf, 1, b - buf, fp);
+	free(buf);
+	free(pixels);
+	
+	// Ok close the file
+	if(fclose(fp) != 0)
+	{
+		fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+		return -1;
+	}
+	
 	printf("\nImage \"%s\" correctly written.\n", filename);
 	
+	return 0;
+}
+
+/*! \fn int writeBinaryPGM(Pgm* pgm, char* filename)
+ * \brief Write the image in PGM P5 (binary) format.
+ *
+ * Samples are one byte wide if the image's maximum value is below 256, two bytes wide (most
+ * significant byte first) otherwise. Pixels outside the interval [0, max_val] are clamped since
+ * the binary format cannot represent them. Whole rows are converted and written at once.
+ * \param pgm Pointer to the Pgm structure with the image.
+ * \param filename Name of the file where the image is written.
+ * \return 0 on success. -1 if no Pgm structure pointer is provided or the file cannot be written.
+ */
+int writeBinaryPGM(Pgm* pgm, char* filename)
+{
+	if(!pgm)
+	{
+		fprintf(stderr, "Error! No data to write. Please Check.\n");
+		return -1;
+	}
+	
+	FILE *fp = fopen(filename, "wb");
+	if(fp == NULL)
+	{
+		fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+		return -1;
+	}
+	
+	int i, j;
+	int pixel;
+	int width = pgm->width;
+	int height = pgm->height;
+	int max_val = pgm->max_val;
+	
+	// The binary format only allows values in [1, 65535] as maximum
+	if(max_val < 1)
+		max_val = 1;
+	if(max_val > 65535)
+		max_val = 65535;
+	
+	int bytes = max_val < 256 ? 1 : 2;
+	unsigned char* row = (unsigned char*)malloc(width*bytes);
+	int* pixels = (int*)malloc(width*sizeof(int));
+	
+	setvbuf(fp, NULL, _IOFBF, 1 << 20);
+	fprintf(fp, "P5\n%d %d\n%d\n", width, height, max_val);
+	
+	// Write image
+	for(i=0; i<height; i++)
+	{
+		if(pgm->format == PGM_U8 && max_val == 255)
+		{
+			// The samples are already in the file format
+			fwrite((unsigned char*)pgm->pixels + (size_t)i*pgm->stride, 1, width, fp);
+			continue;
+		}
+		
+		getRowPGM(pgm, i, 0, width, pixels);
+		if(bytes == 1)
+		{
+			for(j=0; j<width; j++)
+			{
+				pixel = pixels[j] < 0 ? 0 : (pixels[j] > max_val ? max_val : pixels[j]);
+				row[j] = (unsigned char)pixel;
+			}
+		}
+		else
+		{
+			for(j=0; j<width; j++)
+			{
+				pixel = pixels[j] < 0 ? 0 : (pixels[j] > max_val ? max_val : pixels[j]);
+				row[2*j] = (unsigned char)(pixel >> 8);
+				row[2*j+1] = (unsigned char)(pixel & 0xff);
+			}
+		}
+		fwrite(row, bytes, width, fp);
+	}
+	
+	free(pixels);
+	free(row);
+	
 	// Ok close the file
-	fclose(fp);
+	if(fclose(fp) != 0)
+	{
+		fprintf(stderr, "Error! Cannot write \"%s\". Please Check.\n", filename);
+		return -1;
+	}
+	
+	printf("\nImage \"%s\" correctly written.\n", filename);
 	
 	return 0;
 }
@@ -216,7 +975,7 @@ int writePGM(Pgm* pgm, char* filename)
  */
 int invertPGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    int i, inv;
+    int i, j, inv;
     
 	if(!pgmIn || !pgmOut)
 	{
@@ -228,16 +987,26 @@ int invertPGM(Pgm* pgmIn, Pgm* pgmOut)
 	int width = pgmIn->width;
 	int height = pgmIn->height;
     
+    reformatPGM(pgmOut, pgmIn->format);
     pgmOut->max_val = max;
+    
+    int* pixels = (int*)malloc(width*sizeof(int));
 		
 	// Writing Pixels
-	for(i=0; i<width*height; i++)
+	for(i=0; i<height; i++)
 	{
-		// Invert GrayScale Value
-		inv = max - pgmIn->pixels[i];
-		pgmOut->pixels[i] = inv;
+		getRowPGM(pgmIn, i, 0, width, pixels);
+		for(j=0; j<width; j++)
+		{
+			// Invert GrayScale Value
+			inv = max - pixels[j];
+			pixels[j] = inv;
+		}
+		setRowPGM(pgmOut, i, 0, width, pixels);
 	}	
 	
+	free(pixels);
+	
 	return 0;
 }
 
@@ -256,30 +1025,37 @@ int hflipPGM(Pgm* pgmIn, Pgm* pgmOut)
 	}
 	
 	int i, j;
-	int hfp;
 	
-	int* inputPixels = pgmIn->pixels;
-	int* flipPixels = pgmOut->pixels;
-		
 	int width = pgmIn->width;
 	int height = pgmIn->height;
+	
+	int* inputPixels = (int*)malloc(width*sizeof(int));
+	int* flipPixels = (int*)malloc(width*sizeof(int));
+	
+	reformatPGM(pgmOut, pgmIn->format);
 
 	// Modify Pixels
 	for(i=0; i<height; i++)
 	{
+		getRowPGM(pgmIn, i, 0, width, inputPixels);
 		for(j=0; j<width; j++)
 		{
 			// Flip GrayScale Value on width
-			hfp = inputPixels[i*width + j];
-			flipPixels[i*width + (width -j -1)] = hfp;
+			flipPixels[width -j -1] = inputPixels[j];
 		}	
+		setRowPGM(pgmOut, i, 0, width, flipPixels);
 	}
 	
+	free(inputPixels);
+	free(flipPixels);
+	
 	return 0;
 }
 
 /*! \fn int copyPGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Copy a PGM Image.
+ *
+ * The copy has the same storage format of \a pgmIn.
  * \param pgmIn Pointer to the input Pgm structure with the image.
  * \param pgmOut Pointer to the copied Pgm structure.
  * \return 0 on success. -1 if no Pgm structure pointer is provided.
@@ -293,20 +1069,14 @@ int copyPGM(Pgm* pgmIn, Pgm* pgmOut)
 		return -1;
 	}
 	
-	int i;
-	
-	int* inPixels = pgmIn->pixels;
-	int* outPixels = pgmOut->pixels;
-		
-	int width = pgmIn->width;
-	int height = pgmIn->height;
-
-	// Copy image
-	for(i=0; i<width*height; i++)
+	if(pgmOut->format != pgmIn->format)
 	{
-		// Copy image
-		outPixels[i] = inPixels[i];
+		// No need to convert pixels that will be overwritten
+		reformatPGM(pgmOut, pgmIn->format);
 	}
+
+	// Copy image
+	memcpy(pgmOut->pixels, pgmIn->pixels, bytesPGM(pgmIn));
     
     pgmOut->max_val = pgmIn->max_val;
 	
@@ -315,13 +1085,15 @@ int copyPGM(Pgm* pgmIn, Pgm* pgmOut)
 
 /*! \fn int normalizePGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Normalize the Image.
+ *
+ * The pixels values are linearly mapped to the interval [0, 255] whatever the depth of the input image.
  * \param pgmIn Pointer to the input Pgm structure with the image.
  * \param pgmOut Pointer to the Pgm structure with the normalized image.
  * \return 0 on success. -1 if either input pointers is null.
  */
 int normalizePGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    int i;
+    int i, j;
     
     if(!pgmIn || !pgmOut)
     {
@@ -347,12 +1119,25 @@ int normalizePGM(Pgm* pgmIn, Pgm* pgmOut)
         }
     }
     
-    for(i = 0; i<width*height; i++) {
-        pgmOut->pixels[i] = (int)255*(pgmIn->pixels[i] - min_val ) / (top_val-min_val);
+    Pgm* out = targetPGM(pgmOut, PGM_U8, pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for(i = 0; i<height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for(j = 0; j<width; j++) {
+            // A uniform image is mapped to 0
+            if (top_val > min_val)
+                pixels[j] = (int)(255LL*(pixels[j] - min_val) / (top_val-min_val));
+            else
+                pixels[j] = 0;
+        }
+        setRowPGM(out, i, 0, width, pixels);
     }
     
+    storePGM(out, pgmOut);
     pgmOut->max_val = 255;
 
+    free(pixels);
     freeHistogram(&histogram);
 
     return 0;
@@ -360,39 +1145,53 @@ int normalizePGM(Pgm* pgmIn, Pgm* pgmOut)
 
 /*! \fn int equalizePGM(Pgm* pgmIn, Pgm* pgmOut)
  * \brief Equalize the Image.
+ *
+ * Each pixel is mapped to 255 times the fraction of pixels with a lower or equal value.
  * \param pgmIn Pointer to the input Pgm structure with the image.
  * \param pgmOut Pointer to the Pgm structure with the equalized image.
  * \return 0 on success. -1 if either input pointers is null.
  */
 int equalizePGM(Pgm* pgmIn, Pgm* pgmOut)
 {
-    int s, i;
+    int s, i, j;
     if(!pgmIn || !pgmOut)
     {
         fprintf(stderr, "Error! No input data. Please Check.\n");
         return -1;
     }
     
-    int sum;
     int width = pgmIn->width;
     int height = pgmIn->height;
     
     // compute the histogram
     
     Histogram* histogram = histogramPGM(pgmIn);
+    int min_val = histogram->min_val;
 
-    int tot = 0;
+    // compute the cumulative histogram once
+    long long* cumulative = (long long*)malloc(histogram->size*sizeof(long long));
+    long long tot = 0;
     for (s=0; s<histogram->size; s++) {
         tot += histogram->channels[s];
+        cumulative[s] = tot;
     }
-    for(i = 0; i<width*height; i++) {
-        sum = 0;
-        for (s=0; s <= pgmIn->pixels[i]; s++) {
-            sum += histogram->channels[s];
+    
+    Pgm* out = targetPGM(pgmOut, PGM_U8, pgmOut == pgmIn);
+    int* pixels = (int*)malloc(width*sizeof(int));
+    
+    for(i = 0; i<height; i++) {
+        getRowPGM(pgmIn, i, 0, width, pixels);
+        for(j = 0; j<width; j++) {
+            pixels[j] = (int)(255*cumulative[pixels[j]-min_val]/tot);
         }
-        pgmOut->pixels[i] = (int) 255*sum/tot;
+        setRowPGM(out, i, 0, width, pixels);
     }
     
+    storePGM(out, pgmOut);
+    pgmOut->max_val = 255;
+    
+    free(pixels);
+    free(cumulative);
     freeHistogram(&histogram);
     return 0;
 }
@@ -410,34 +1209,39 @@ Histogram* histogramPGM(Pgm* pgm)
         return NULL;
     }
     
-    int i,index, pixel;
+    int i, j;
     int width = pgm->width;
     int height = pgm->height;
     int max_val = pgm->max_val;
+    int* pixels = (int*)malloc(width*sizeof(int));
     
     Histogram* histo = (Histogram*)calloc(1, sizeof(Histogram));
-    histo->max_val = max_val;
     
+    // the histogram covers at least [min_val; max_val] and any pixel above max_val
     int min_val = max_val;
-    for(i=0; i<width*height; i++)
+    const KernelSet* kernels = kernelsPGM();
+    for(i=0; i<height; i++)
     {
-        pixel = pgm->pixels[i];
-        if ( pixel < min_val )
-            min_val = pixel;
+        getRowPGM(pgm, i, 0, width, pixels);
+        kernels->rangeRow(pixels, width, &min_val, &max_val);
     }
     histo->min_val = min_val;
+    histo->max_val = max_val;
     histo->size = max_val - min_val + 1;
     
     // if max_val is 255 each pixel of the image can have a value between [0;255]
     // so histogram have a dimension of 256
     histo->channels = (int*)calloc(histo->size,sizeof(int));
     
-    for(i=0; i<width*height; i++)
+    for(i=0; i<height; i++)
     {
-        index = pgm->pixels[i]-min_val;
-        histo->channels[index]++;
+        getRowPGM(pgm, i, 0, width, pixels);
+        for(j=0; j<width; j++)
+            histo->channels[pixels[j]-min_val]++;
     }
     
+    free(pixels);
+    
     return histo;
 }
 
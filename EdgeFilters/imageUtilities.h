@@ -13,6 +13,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //#define __DEBUG__
 
@@ -22,17 +31,92 @@
 #define D(a)
 #endif
 
+/*! \def ROW_ALIGN
+ * \brief Alignment in bytes of the first pixel of each image row.
+ */
+#define ROW_ALIGN 64
+
+/*! \def ARENA_SLOTS
+ * \brief Maximum number of released pixels buffers kept by the scratch arena.
+ */
+#define ARENA_SLOTS 16
+
+/*! \def HUGE_PAGE_BYTES
+ * \brief Size of a huge page. Smaller buffers are never backed by huge pages.
+ */
+#define HUGE_PAGE_BYTES (2 << 20)
+
+/*! \enum PgmFormat
+ * \brief Storage format of the pixels of a Pgm image.
+ */
+typedef enum
+{
+  PGM_U8,  /*!< One unsigned byte per pixel */
+  PGM_U16, /*!< One unsigned 16-bit word per pixel */
+  PGM_S16, /*!< One signed 16-bit word per pixel */
+  PGM_S32, /*!< One signed integer per pixel */
+  PGM_F32  /*!< One single precision float per pixel */
+} PgmFormat;
+
 /*! \struct Pgm
  * \brief Structure to store PGM format images.
  */
 typedef struct 
 {
-  int width;   /*!< Image's width */
-  int height;  /*!< Image's height */
-  int max_val; /*!< Image's maximum pixel values */
-  int* pixels; /*!< Pointer to the array of pixels values */
+  int width;        /*!< Image's width */
+  int height;       /*!< Image's height */
+  int max_val;      /*!< Image's maximum pixel values */
+  PgmFormat format; /*!< Storage format of the pixels */
+  int stride;       /*!< Distance in pixels between the first pixels of two consecutive rows */
+  void* pixels;     /*!< Pointer to the array of pixels values */
 } Pgm;
 
+/*! \fn int getPixelPGM(Pgm* pgm, int i)
+ * \brief Return the value of the pixel linearly indexed by \a i in \a pgm.
+ *
+ * The pixel at (row, col) has linear index row * pgm->stride + col.
+ */
+static inline int getPixelPGM(Pgm* pgm, int i)
+{
+  switch(pgm->format)
+  {
+    case PGM_U8:
+      return ((unsigned char*)pgm->pixels)[i];
+    case PGM_U16:
+      return ((unsigned short*)pgm->pixels)[i];
+    case PGM_S16:
+      return ((short*)pgm->pixels)[i];
+    case PGM_F32:
+      return (int)floorf(((float*)pgm->pixels)[i]);
+    default:
+      return ((int*)pgm->pixels)[i];
+  }
+}
+
+/*! \fn void setPixelPGM(Pgm* pgm, int i, int value)
+ * \brief Set the pixel linearly indexed by \a i in \a pgm to \a value, saturated to the storage format.
+ */
+static inline void setPixelPGM(Pgm* pgm, int i, int value)
+{
+  switch(pgm->format)
+  {
+    case PGM_U8:
+      ((unsigned char*)pgm->pixels)[i] = value < 0 ? 0 : (value > 255 ? 255 : value);
+      break;
+    case PGM_U16:
+      ((unsigned short*)pgm->pixels)[i] = value < 0 ? 0 : (value > 65535 ? 65535 : value);
+      break;
+    case PGM_S16:
+      ((short*)pgm->pixels)[i] = value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+      break;
+    case PGM_F32:
+      ((float*)pgm->pixels)[i] = (float)value;
+      break;
+    default:
+      ((int*)pgm->pixels)[i] = value;
+  }
+}
+
 /*! \struct Histogram
  * \brief Structure to store images Histograms.
  */
@@ -48,10 +132,28 @@ typedef struct
 //------------ Input/Output Functions for PGM -------------//
 //---------------------------------------------------------// 
 Pgm* newPGM(int width, int height, int max_val);
+Pgm* newFormatPGM(int width, int height, int max_val, PgmFormat format);
+Pgm* scratchPGM(int width, int height, int max_val, PgmFormat format);
 Pgm* readPGM(char* filename);
 int writePGM(Pgm* pgm, char* filename);
+int writeBinaryPGM(Pgm* pgm, char* filename);
 void resetPGM(Pgm* pgm);
 void freePGM(Pgm** pgm);
+int formatPGM(Pgm* pgm, PgmFormat format);
+int reformatPGM(Pgm* pgm, PgmFormat format);
+void swapPGM(Pgm* pgm1, Pgm* pgm2);
+Pgm* targetPGM(Pgm* pgmOut, PgmFormat format, int inPlace);
+void storePGM(Pgm* target, Pgm* pgmOut);
+void* getBufferPGM(size_t bytes);
+void putBufferPGM(void* buffer, size_t bytes);
+void clearBuffersPGM(void);
+void hugePagesPGM(int enable);
+size_t bytesPGM(Pgm* pgm);
+PgmFormat fitFormatPGM(double min, double max);
+void rangeFormatPGM(PgmFormat format, double* min, double* max);
+void rangePGM(Pgm* pgm, int* min, int* max);
+void getRowPGM(Pgm* pgm, int row, int col, int len, int* buf);
+void setRowPGM(Pgm* pgm, int row, int col, int len, int* buf);
 
 //---------------------------------------------------------//
 //----------------- Basic Functions for PGM ---------------//
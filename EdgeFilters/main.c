@@ -16,6 +16,7 @@
 #include "imageBasicOps.h"
 #include "imageFilterOps.h"
 #include "imageContours.h"
+#include "imageKernels.h"
 #include "test.h"
 
 #define MAXBUF 4096
@@ -59,14 +60,19 @@ int main(int argc, char** argv)
 
     int c;
     int oflag = FALSE;
+    int bflag = FALSE;
+    int eflag = FALSE;
+    int gflag = FALSE;
+    EdgeListFormat edgeFormat = EDGE_LIST_RAW;
     FILE *fp = NULL;
     char *filename;
+    char *isa = getenv(KERNELS_ENV);
     
     char inputFile[MAXBUF];
     char outputFile[MAXBUF];
     char command[MAXBUF];
 
-    while ( (c = getopt(argc, argv, "f:o:")) != -1) {
+    while ( (c = getopt(argc, argv, "f:o:bHi:e:g")) != -1) {
         switch (c) {
             case 'f':
                 filename = basename(optarg);
@@ -82,6 +88,29 @@ int main(int argc, char** argv)
                 oflag = TRUE;
                 strncpy(outputFile, optarg, sizeof(outputFile));
                 break;
+            case 'b':
+                bflag = TRUE;
+                break;
+            case 'H':
+                hugePagesPGM(1);
+                break;
+            case 'i':
+                isa = optarg;
+                break;
+            case 'e':
+                eflag = TRUE;
+                if (strcmp(optarg, "raw") == 0)
+                    edgeFormat = EDGE_LIST_RAW;
+                else if (strcmp(optarg, "varint") == 0)
+                    edgeFormat = EDGE_LIST_VARINT;
+                else {
+                    fprintf(stderr, "Error! Unknown edge list format %s (raw or varint). Please Check.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'g':
+                gflag = TRUE;
+                break;
             default:
                 break;
         }
@@ -91,6 +120,10 @@ int main(int argc, char** argv)
         printf("Error! No command file name\n");
         exit(1);
     }
+    
+    if (selectKernelsPGM(isa) < 0)
+        exit(1);
+    fprintf(stderr, "Kernels: %s\n", kernelsPGM()->name);
 
     argc -= optind;
     argv += optind;
@@ -114,18 +147,30 @@ int main(int argc, char** argv)
         removeExt(outputFile);
     }
     
-    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, 255);
+    Pgm* imgOut = scratchPGM(imgIn->width, imgIn->height, 255, imgIn->format);
     
-    execImageOps(imgIn, imgOut, fp);
+    execImageOps(imgIn, imgOut, fp, outputFile, bflag);
     
     // calculate histogram and write it in a file
     calcHist(imgOut);
     
-    sprintf(pname,"%s_%s.pgm", outputFile, command);
-    writePGM(imgOut,pname);
+    if (eflag == TRUE) {
+        // only the position of the edges, and their gradient in the input image
+        if (snprintf(pname, sizeof(pname), "%s_%s.edg", outputFile, command) >= (int)sizeof(pname))
+            fprintf(stderr, "Error! The name of the edge list is too long. Please Check.\n");
+        else
+            writeEdgeList(imgOut, gflag == TRUE ? imgIn : NULL, edgeFormat, pname);
+    } else {
+        sprintf(pname,"%s_%s.pgm", outputFile, command);
+        if (bflag == TRUE)
+            writeBinaryPGM(imgOut,pname);
+        else
+            writePGM(imgOut,pname);
+    }
     
     freePGM(&imgIn);
     freePGM(&imgOut);
+    clearBuffersPGM();
     fclose(fp);
     
     return 0;
@@ -42,9 +42,7 @@ for f in $IMGNAME ${IMGNAME}_noiseu ${IMGNAME}_noisesp; do
 #   DoG
     echo ""
     echo "* DoG"
-    $CMDLINE -f ${FILTER_DIR}/dog_2.flt $filename
-    $CMDLINE -f ${FILTER_DIR}/dog_4.flt $filename
-    $CMDLINE -f ${FILTER_DIR}/dog_6.flt $filename
+    $CMDLINE -f ${FILTER_DIR}/dog_stack.flt $filename
     $CMDLINE -f ${FILTER_DIR}/dog_2_T.flt $filename
     $CMDLINE -f ${FILTER_DIR}/dog_4_T.flt $filename
     $CMDLINE -f ${FILTER_DIR}/dog_6_T.flt $filename
@@ -10,9 +10,59 @@
 #include "imageFilters.h"
 #include "imageBasicOps.h"
 #include "imageFilterOps.h"
+#include "imageFFT.h"
+#include "imageKernels.h"
 
 #define MAXBUF 4096
 
+/*! \fn int diffPGM(Pgm* pgm1, Pgm* pgm2)
+ * \brief Return the largest difference between the pixels of \a pgm1 and \a pgm2, INT_MAX if their sizes differ.
+ */
+int diffPGM(Pgm* pgm1, Pgm* pgm2)
+{
+    int i, j, diff;
+    int maxDiff = 0;
+    
+    if (pgm1->width != pgm2->width || pgm1->height != pgm2->height)
+        return INT_MAX;
+    
+    int* row1 = (int*)malloc(pgm1->width*sizeof(int));
+    int* row2 = (int*)malloc(pgm1->width*sizeof(int));
+    for (i = 0; i < pgm1->height; i++) {
+        getRowPGM(pgm1, i, 0, pgm1->width, row1);
+        getRowPGM(pgm2, i, 0, pgm1->width, row2);
+        for (j = 0; j < pgm1->width; j++) {
+            diff = abs(row1[j]-row2[j]);
+            maxDiff = diff > maxDiff ? diff : maxDiff;
+        }
+    }
+    
+    free(row1);
+    free(row2);
+    
+    return maxDiff;
+}
+
+/*! \fn Pgm* samplePGM(const char** rows, int width, int height)
+ * \brief Return a new image of \a height \a rows of \a width characters, 255 for '#' and 0 otherwise.
+ */
+Pgm* samplePGM(const char** rows, int width, int height)
+{
+    int i, j;
+    Pgm* pgm = newPGM(width, height, 255);
+    int* row = (int*)malloc(width*sizeof(int));
+    
+    for (i = 0; i < height; i++) {
+        for (j = 0; j < width; j++)
+            row[j] = rows[i][j] == '#' ? 255 : 0;
+        setRowPGM(pgm, i, 0, width, row);
+    }
+    
+    free(row);
+    
+    return pgm;
+}
+
 int testBasicFunctions(Pgm* imgIn)
 {
     Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
@@ -47,27 +97,14 @@ int testBasicFunctions(Pgm* imgIn)
 int testSharpening(Pgm* imgIn, char* outputFile)
 {
     char pname[MAXBUF];
-    Filter* filter;
     
     Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
     Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
     Pgm* imgOut2 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
     
-    // apply a identity filter
-    Filter *idFilter = identityFilter(3,3);
-    
-    // apply a box filter
-    Filter *bxFilter = boxFilter(3,3);
-    
-    // sharpening
-    
-    filter = linearAddFilter(idFilter, bxFilter, 2.0, -1.0);
-    freeFilter(&idFilter);
-    freeFilter(&bxFilter);
-    
+    // sharpening: twice the identity minus a box filter
     resetPGM(imgOut1);
-    convolution2DPGM(imgIn, imgOut1, filter);
-    freeFilter(&filter);
+    sharpeningPGM(imgIn, imgOut1);
 
     resetPGM(imgOut);
     normalizePGM(imgOut1, imgOut);
@@ -170,6 +207,53 @@ int testGauss(Pgm* imgIn, char* outputFile)
     return 0;
 }
 
+int testGaussIIR(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int i, j, k, diff, maxDiff;
+    double meanDiff;
+    const double sigmas[2] = {4, 8};
+    int ret = 0;
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    int* row = (int*)malloc(imgIn->width*sizeof(int));
+    int* row1 = (int*)malloc(imgIn->width*sizeof(int));
+    
+    // the recursive filters must stay close to the convolutions they replace
+    for (k = 0; k < 2; k++) {
+        gaussPGM(imgIn, imgOut, sigmas[k], 0);
+        gaussPGM(imgIn, imgOut1, sigmas[k], GAUSS_IIR);
+        
+        maxDiff = 0;
+        meanDiff = 0;
+        for (i = 0; i < imgIn->height; i++) {
+            getRowPGM(imgOut, i, 0, imgIn->width, row);
+            getRowPGM(imgOut1, i, 0, imgIn->width, row1);
+            for (j = 0; j < imgIn->width; j++) {
+                diff = abs(row[j]-row1[j]);
+                maxDiff = diff > maxDiff ? diff : maxDiff;
+                meanDiff += diff;
+            }
+        }
+        meanDiff /= (double)imgIn->width*imgIn->height;
+        fprintf(stderr, "\nRecursive Gauss (sigma = %g): max error %d, mean error %f\n", sigmas[k], maxDiff, meanDiff);
+        // the bound of recursiveGaussPGM(), 3 levels out of 255
+        if (maxDiff > 3 && maxDiff > 3*imgIn->max_val/255)
+            ret = -1;
+    }
+    
+    sprintf(pname,"%s_gauss_iir.pgm", outputFile);
+    writePGM(imgOut1, pname);
+    
+    free(row);
+    free(row1);
+    freePGM(&imgOut);
+    freePGM(&imgOut1);
+    
+    return ret;
+}
+
 int testDoG(Pgm* imgIn, char* outputFile)
 {
     char pname[MAXBUF];
@@ -202,6 +286,331 @@ int testDoG(Pgm* imgIn, char* outputFile)
     return 0;
 }
 
+int testDoGStack(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int k;
+    double sigmas[3] = {2, 4, 6};
+    Pgm* imgOuts[3];
+    
+    for (k = 0; k < 3; k++)
+        imgOuts[k] = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    // the three DoG filters from a single scale space
+    dogStackPGM(imgIn, imgOuts, sigmas, 3);
+    
+    for (k = 0; k < 3; k++) {
+        sprintf(pname,"%s_dog_stack_%g.pgm", outputFile, sigmas[k]);
+        writePGM(imgOuts[k], pname);
+        freePGM(&imgOuts[k]);
+    }
+    
+    return 0;
+}
+
+int testCanny(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int k, diff;
+    int ret = 0;
+    Filter* filter;
+    
+    Pgm* imgSmooth = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgX = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgY = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgModule = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgPhase = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    // the fused pass must give the same result of the separate stages, with both border policies
+    gaussPGM(imgIn, imgSmooth, sqrt(2.0), 0);
+    for (k = 0; k < 2; k++) {
+        borderPGM(k == 0 ? BORDER_REPLICATE : BORDER_REFLECT, 0);
+        
+        filter = sobelXFilter();
+        convolution2DPGM(imgSmooth, imgX, filter);
+        freeFilter(&filter);
+        filter = sobelYFilter();
+        convolution2DPGM(imgSmooth, imgY, filter);
+        freeFilter(&filter);
+        modulePGM(imgX, imgY, imgModule);
+        phasePGM(imgX, imgY, imgPhase);
+        suppressionPGM(imgModule, imgPhase, imgOut);
+        
+        cannyPGM(imgSmooth, imgOut1);
+        
+        diff = diffPGM(imgOut, imgOut1);
+        fprintf(stderr, "\nCanny with %s borders: max difference %d from the separate stages\n",
+                k == 0 ? "replicated" : "reflected", diff);
+        if (diff != 0)
+            ret = -1;
+    }
+    borderPGM(BORDER_REPLICATE, 0);
+    
+    sprintf(pname,"%s_canny.pgm", outputFile);
+    writePGM(imgOut1, pname);
+    
+    freePGM(&imgSmooth);
+    freePGM(&imgX);
+    freePGM(&imgY);
+    freePGM(&imgModule);
+    freePGM(&imgPhase);
+    freePGM(&imgOut);
+    freePGM(&imgOut1);
+    
+    return ret;
+}
+
+int testSeparable(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int i, j, k, diff;
+    int ret = 0;
+    Filter* filters[2];
+    const double a[7] = {1, 2, 3, 4, 3, 2, 1};
+    const double b[7] = {1, 0, -1, 2, -1, 0, 1};
+    const double c[7] = {0, 1, 0, -2, 0, 1, 0};
+    const double d[7] = {2, 1, 1, 1, 1, 1, 2};
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    // a Gauss kernel, of a single term, and an integer kernel of two terms
+    filters[0] = gauss2DFilter(2, 0);
+    filters[1] = newFilter(7, 7);
+    for (i = 0; i < 7; i++)
+        for (j = 0; j < 7; j++)
+            filters[1]->kernel[i*7+j] = a[i]*b[j]+c[i]*d[j];
+    
+    // the two passes must give the same result of the direct convolution, up to the rounding for the Gauss kernel
+    for (k = 0; k < 2; k++) {
+        if (separableConvolutionPGM(imgIn, imgOut, filters[k]) < 0)
+            ret = -1;
+        stripApplyPGM(imgIn, NULL, imgOut1, filters[k], 0, 0, NULL, kernelsPGM()->convolutionRow);
+        diff = diffPGM(imgOut, imgOut1);
+        fprintf(stderr, "\nSeparable convolution (%s kernel): max difference %d from the direct convolution\n",
+                k == 0 ? "Gauss" : "rank 2 integer", diff);
+        if (diff > (k == 0 ? 1 : 0))
+            ret = -1;
+        freeFilter(&filters[k]);
+    }
+    
+    sprintf(pname,"%s_separable.pgm", outputFile);
+    writePGM(imgOut, pname);
+    
+    freePGM(&imgOut);
+    freePGM(&imgOut1);
+    
+    return ret;
+}
+
+int testFFT(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int i, diff;
+    int ret = 0;
+    Filter* filter;
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    // an integer 35x35 kernel, above FFT_CROSSOVER and not separable: the results must be the same
+    fprintf(stderr, "\nFFT convolution (integer 35x35 kernel)\n");
+    filter = newFilter(35, 35);
+    for (i = 0; i < 35*35; i++)
+        filter->kernel[i] = (i*7)%5-2;
+    
+    fftConvolution2DPGM(imgIn, imgOut, filter);
+    stripApplyPGM(imgIn, NULL, imgOut1, filter, 0, 0, NULL, kernelsPGM()->convolutionRow);
+    diff = diffPGM(imgOut, imgOut1);
+    fprintf(stderr, "Max difference %d from the direct convolution\n", diff);
+    if (diff != 0)
+        ret = -1;
+    freeFilter(&filter);
+    
+    // a 47x47 Gauss filter, well above the size where the FFT pays: the results can differ by the rounding
+    fprintf(stderr, "\nFFT convolution (sigma = 8)\n");
+    filter = gauss2DFilter(8, 0);
+    
+    fftConvolution2DPGM(imgIn, imgOut, filter);
+    stripApplyPGM(imgIn, NULL, imgOut1, filter, 0, 0, NULL, kernelsPGM()->convolutionRow);
+    diff = diffPGM(imgOut, imgOut1);
+    fprintf(stderr, "Max difference %d from the direct convolution\n", diff);
+    if (diff > 1)
+        ret = -1;
+    sprintf(pname,"%s_gauss_fft.pgm", outputFile);
+    writePGM(imgOut, pname);
+    
+    freeFilter(&filter);
+    freePGM(&imgOut);
+    freePGM(&imgOut1);
+    
+    return ret;
+}
+
+int testLabel(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    Component* components;
+    int k, count;
+    int ret = 0;
+    const char* sample[6] = {
+        "##......",
+        "##..#...",
+        "..#..#..",
+        "........",
+        ".###...#",
+        "......##"};
+    // the diagonal pixels join the first components only with 8-connectivity
+    const int connectivity[2] = {4, 8};
+    const int counts[2] = {6, 4};
+    const Component firsts[2] = {{4, 0, 0, 1, 1}, {5, 0, 0, 2, 2}};
+    const Component last = {3, 6, 4, 7, 5};
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgSample = samplePGM(sample, 8, 6);
+    
+    // count the components of the sample and check the area and the bounding box of the first and the last
+    for (k = 0; k < 2; k++) {
+        count = labelPGM(imgSample, imgOut, connectivity[k], &components);
+        fprintf(stderr, "\nSample with %d-connectivity: %d components\n", connectivity[k], count);
+        if (count != counts[k] || memcmp(&components[0], &firsts[k], sizeof(Component)) != 0 ||
+            memcmp(&components[count-1], &last, sizeof(Component)) != 0)
+            ret = -1;
+        if (count >= 0)
+            free(components);
+    }
+    
+    // label the edges found by the Canny detector
+    fprintf(stderr, "\nConnected components of the CED edges\n");
+    cedPGM(imgIn, imgOut, sqrt(2.0), 0, 25, 75);
+    
+    count = labelPGM(imgOut, imgOut, 8, &components);
+    fprintf(stderr, "%d components\n", count);
+    sprintf(pname,"%s_label.pgm", outputFile);
+    writePGM(imgOut, pname);
+    sprintf(pname,"%s_label.dat", outputFile);
+    writeComponents(components, count, pname);
+    
+    free(components);
+    freePGM(&imgOut);
+    freePGM(&imgSample);
+    
+    return ret;
+}
+
+int testContours(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    Contours* contours;
+    int i, k, x, y, holes;
+    int ret = 0;
+    const char* sample[10] = {
+        "..........",
+        ".#####..#.",
+        ".#...#....",
+        ".#.#.#.##.",
+        ".#...#.##.",
+        ".#####....",
+        "..........",
+        "..####....",
+        "..#..#....",
+        "..####...."};
+    // the steps of the chain codes, as in imageContours.c
+    const int dx[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    const int dy[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgSample = samplePGM(sample, 10, 10);
+    
+    // two rings with a hole each, a pixel inside a hole, an isolated pixel and a block:
+    // 5 outer borders and 2 holes, and each chain must end on its first point
+    contours = traceContoursPGM(imgSample);
+    for (k = 0, holes = 0; k < contours->count; k++) {
+        holes += contours->contours[k].hole;
+        x = contours->contours[k].x;
+        y = contours->contours[k].y;
+        for (i = 0; i < contours->contours[k].length; i++) {
+            x += dx[contours->codes[contours->contours[k].first+i]];
+            y += dy[contours->codes[contours->contours[k].first+i]];
+        }
+        if (x != contours->contours[k].x || y != contours->contours[k].y)
+            ret = -1;
+    }
+    fprintf(stderr, "\nSample: %d outer borders, %d holes\n", contours->count-holes, holes);
+    if (contours->count-holes != 5 || holes != 2)
+        ret = -1;
+    freeContours(&contours);
+    
+    // follow the borders of the thresholded image
+    fprintf(stderr, "\nBorders of the thresholded image\n");
+    thresholdPGM(imgIn, imgOut, 128);
+    
+    contours = traceContoursPGM(imgOut);
+    fprintf(stderr, "%d contours, %d chain codes\n", contours->count, contours->size);
+    sprintf(pname,"%s_contours.bin", outputFile);
+    writeContours(contours, pname);
+    
+    freeContours(&contours);
+    freePGM(&imgOut);
+    freePGM(&imgSample);
+    
+    return ret;
+}
+
+int testEdgeList(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    unsigned char record[7];
+    int i, p, module, phase, value, count, errors;
+    FILE* fp;
+    
+    Pgm* imgEdges = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgModule = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    Pgm* imgPhase = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    // the gradients of the edge list must be the ones of sobelPGM() with the same border policy
+    borderPGM(BORDER_REFLECT, 0);
+    thresholdPGM(imgIn, imgEdges, imgIn->max_val/2);
+    sobelPGM(imgIn, imgModule, 0);
+    sobelPGM(imgIn, imgPhase, 1);
+    
+    sprintf(pname,"%s_edges.edg", outputFile);
+    writeEdgeList(imgEdges, imgIn, EDGE_LIST_RAW, pname);
+    
+    errors = 0;
+    fp = fopen(pname, "rb");
+    if (fp == NULL || fseek(fp, 12, SEEK_SET) != 0 || fread(record, 1, 4, fp) != 4)
+        errors = -1;
+    else {
+        count = record[0] | record[1] << 8 | record[2] << 16 | record[3] << 24;
+        fseek(fp, 4, SEEK_CUR);
+        for (i = 0; i < count && fread(record, 1, 7, fp) == 7; i++) {
+            p = record[0] | record[1] << 8 | record[2] << 16 | record[3] << 24;
+            module = record[4] | record[5] << 8;
+            phase = (signed char)record[6];
+            // the raw records saturate the module at 16 bits
+            value = getPixelPGM(imgModule, (p/imgIn->width)*imgModule->stride+p%imgIn->width);
+            if (module != (value > 65535 ? 65535 : value) ||
+                phase != getPixelPGM(imgPhase, (p/imgIn->width)*imgPhase->stride+p%imgIn->width))
+                errors++;
+        }
+        if (i < count)
+            errors = -1;
+    }
+    if (fp != NULL)
+        fclose(fp);
+    borderPGM(BORDER_REPLICATE, 0);
+    fprintf(stderr, "\nEdge list with reflected borders: %d gradients differ from sobel\n", errors);
+    
+    freePGM(&imgEdges);
+    freePGM(&imgModule);
+    freePGM(&imgPhase);
+    
+    return errors == 0 ? 0 : -1;
+}
+
 int testNoise(Pgm *imgIn, char* outputFile)
 {
     char pname[MAXBUF];
@@ -236,9 +645,7 @@ int testDenoise(Pgm* imgIn, char* outputFile)
     Pgm* imgOut1 = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
     
     // apply a box filter to compute the average
-    Filter *filter = boxFilter(3,3);
-    convolution2DPGM(imgIn, imgOut, filter);
-    freeFilter(&filter);
+    averagePGM(imgIn, imgOut, 3, 3);
 
     normalizePGM(imgOut, imgOut1);
     sprintf(pname,"%s_average.pgm", outputFile);
@@ -248,7 +655,7 @@ int testDenoise(Pgm* imgIn, char* outputFile)
     resetPGM(imgOut1);
     
     // apply a median filter
-    medianPGM(imgIn, imgOut);
+    medianPGM(imgIn, imgOut, 1);
     normalizePGM(imgOut, imgOut1);
     sprintf(pname,"%s_median.pgm", outputFile);
     writePGM(imgOut1,pname);
@@ -259,6 +666,83 @@ int testDenoise(Pgm* imgIn, char* outputFile)
     return 0;
 }
 
+int testMedian(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    int i, j, k, l, t, u, v, radius, policy, errors, value;
+    int window[25];
+    int ret = 0;
+    Pgm* imgs[2];
+    Pgm* imgOut;
+    int *pixels, *out;
+    // not a multiple of MEDIAN_BLOCK, so that the last block of each row is partial
+    const int width = 2*MEDIAN_BLOCK+37;
+    const int height = 19;
+    
+    Pgm* imgSample = newPGM(width, height, 255);
+    int* row = (int*)malloc(width*sizeof(int));
+    for (i = 0; i < height; i++) {
+        for (j = 0; j < width; j++)
+            row[j] = (i*131+j*71+(i*j)%97)%256;
+        setRowPGM(imgSample, i, 0, width, row);
+    }
+    free(row);
+    
+    imgs[0] = imgSample;
+    imgs[1] = imgIn;
+    
+    // the sorting networks of medianPGM() against the median of the sorted window, with both border policies
+    for (t = 0; t < 2; t++) {
+        imgOut = newPGM(imgs[t]->width, imgs[t]->height, imgs[t]->max_val);
+        pixels = (int*)malloc((size_t)imgs[t]->width*imgs[t]->height*sizeof(int));
+        out = (int*)malloc(imgs[t]->width*sizeof(int));
+        for (i = 0; i < imgs[t]->height; i++)
+            getRowPGM(imgs[t], i, 0, imgs[t]->width, pixels+(size_t)i*imgs[t]->width);
+        
+        for (policy = 0; policy < 2; policy++)
+            for (radius = 1; radius <= 2; radius++) {
+                borderPGM(policy == 0 ? BORDER_REPLICATE : BORDER_REFLECT, 0);
+                medianPGM(imgs[t], imgOut, radius);
+                errors = 0;
+                for (i = 0; i < imgs[t]->height; i++) {
+                    getRowPGM(imgOut, i, 0, imgs[t]->width, out);
+                    for (j = 0; j < imgs[t]->width; j++) {
+                        // insertion sort of the window
+                        for (k = -radius, u = 0; k <= radius; k++)
+                            for (l = -radius; l <= radius; l++, u++) {
+                                value = pixels[(size_t)borderIndex(i+k, imgs[t]->height)*imgs[t]->width+
+                                               borderIndex(j+l, imgs[t]->width)];
+                                for (v = u; v > 0 && window[v-1] > value; v--)
+                                    window[v] = window[v-1];
+                                window[v] = value;
+                            }
+                        if (out[j] != window[u/2])
+                            errors++;
+                    }
+                }
+                fprintf(stderr, "\nMedian %dx%d of the %s with %s borders: %d pixels differ from the sorted window\n",
+                        2*radius+1, 2*radius+1, t == 0 ? "sample" : "image", policy == 0 ? "replicated" : "reflected",
+                        errors);
+                if (errors != 0)
+                    ret = -1;
+            }
+        borderPGM(BORDER_REPLICATE, 0);
+        
+        if (t == 1) {
+            sprintf(pname,"%s_median_5x5.pgm", outputFile);
+            writePGM(imgOut, pname);
+        }
+        
+        free(pixels);
+        free(out);
+        freePGM(&imgOut);
+    }
+    
+    freePGM(&imgSample);
+    
+    return ret;
+}
+
 int testOP39(Pgm* imgIn, char* outputFile)
 {
     char pname[MAXBUF];
@@ -297,8 +781,26 @@ int testNagao(Pgm* imgIn, char* outputFile)
     return 0;
 }
 
+int testKuwahara(Pgm* imgIn, char* outputFile)
+{
+    char pname[MAXBUF];
+    
+    Pgm* imgOut = newPGM(imgIn->width, imgIn->height, imgIn->max_val);
+    
+    kuwaharaPGM(imgIn, imgOut, 2);
+    
+    sprintf(pname,"%s_kuwahara.pgm", outputFile);
+    writePGM(imgOut,pname);
+    
+    freePGM(&imgOut);
+    
+    return 0;
+}
+
 int testAll(Pgm *imgIn, char* outputFile)
 {
+    int ret = 0;
+    
     // test basic copy, flip, invert, normalize and equalize
     testBasicFunctions(imgIn);
     
@@ -311,20 +813,74 @@ int testAll(Pgm *imgIn, char* outputFile)
     // test denoise filters
     testDenoise(imgIn, outputFile);
     
+    // test the 3x3 and 5x5 medians
+    if (testMedian(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The 3x3 or 5x5 median differs from the sorted window. Please Check.\n");
+        ret = -1;
+    }
+    
     // test Sobel
     testSobel(imgIn, outputFile);
     
     // test Gauss filter
     testGauss(imgIn, outputFile);
     
+    // test the separable convolution
+    if (testSeparable(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The separable convolution differs from the direct one. Please Check.\n");
+        ret = -1;
+    }
+    
+    // test the recursive Gauss filter
+    if (testGaussIIR(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The recursive Gauss filter is not accurate enough. Please Check.\n");
+        ret = -1;
+    }
+    
+    // test the fused Canny pass
+    if (testCanny(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The fused Canny pass differs from the separate stages. Please Check.\n");
+        ret = -1;
+    }
+    
+    // test the FFT convolution
+    if (testFFT(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The FFT convolution differs from the direct one. Please Check.\n");
+        ret = -1;
+    }
+    
     // test DoG filter
     testDoG(imgIn, outputFile);
     
+    // test the DoG scale space
+    testDoGStack(imgIn, outputFile);
+    
+    // test the connected components labeling
+    if (testLabel(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The components of the sample image are wrong. Please Check.\n");
+        ret = -1;
+    }
+    
+    // test the border following
+    if (testContours(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The borders of the sample image are wrong. Please Check.\n");
+        ret = -1;
+    }
+    
+    // test the gradients of the edge list
+    if (testEdgeList(imgIn, outputFile) < 0) {
+        fprintf(stderr, "Error! The gradients of the edge list differ from sobel. Please Check.\n");
+        ret = -1;
+    }
+    
     // test the 3/9 operator
     testOP39(imgIn, outputFile);
     
     // test the 3/9 operator
     testNagao(imgIn, outputFile);
     
-    return 0;
+    // test the Kuwahara filter
+    testKuwahara(imgIn, outputFile);
+    
+    return ret;
 }
\ No newline at end of file
@@ -16,11 +16,21 @@ int testBasicFunctions(Pgm* imgIn);
 int testSharpening(Pgm* imgIn, char* outputFile);
 int testSobel(Pgm* imgIn, char* outputFile);
 int testGauss(Pgm* imgIn, char* outputFile);
+int testGaussIIR(Pgm* imgIn, char* outputFile);
+int testSeparable(Pgm* imgIn, char* outputFile);
 int testDoG(Pgm* imgIn, char* outputFile);
+int testDoGStack(Pgm* imgIn, char* outputFile);
+int testCanny(Pgm* imgIn, char* outputFile);
+int testFFT(Pgm* imgIn, char* outputFile);
+int testLabel(Pgm* imgIn, char* outputFile);
+int testContours(Pgm* imgIn, char* outputFile);
+int testEdgeList(Pgm* imgIn, char* outputFile);
 int testNoise(Pgm *imgIn, char* outputFile);
 int testDenoise(Pgm* imgIn, char* outputFile);
+int testMedian(Pgm* imgIn, char* outputFile);
 int testOP39(Pgm* imgIn, char* outputFile);
 int testNagao(Pgm* imgIn, char* outputFile);
+int testKuwahara(Pgm* imgIn, char* outputFile);
 int testAll(Pgm *imgIn, char* outputFile);
 
 #endif /* test_h */